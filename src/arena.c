@@ -0,0 +1,57 @@
+#include <string.h>
+#include <stdlib.h>
+#include "arena.h"
+
+extern void die_out_of_memory(void);
+
+#define CHUNK_SIZE (64*1024)
+#define ALIGN(n) (((n) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t size;
+    char data[];
+};
+
+void* arena_alloc(struct arena *arena, size_t size)
+{
+    struct arena_chunk *chunk = arena->chunks;
+
+    size = ALIGN(size);
+    if (!chunk || arena->used + size > chunk->size) {
+        size_t len = size > CHUNK_SIZE ? size : CHUNK_SIZE;
+        if (!(chunk = malloc(sizeof(*chunk) + len))) {
+            die_out_of_memory();
+        }
+        chunk->next = arena->chunks;
+        chunk->size = len;
+        arena->chunks = chunk;
+        arena->used = 0;
+        arena->reserved += sizeof(*chunk) + len;
+    }
+
+    void *ptr = chunk->data + arena->used;
+    arena->used += size;
+    arena->bytes += size;
+    return ptr;
+}
+
+char* arena_strndup(struct arena *arena, const char *str, size_t len)
+{
+    char *s = arena_alloc(arena, len + 1);
+    memcpy(s, str, len);
+    s[len] = '\0';
+    return s;
+}
+
+void free_arena(struct arena *arena)
+{
+    struct arena_chunk *chunk;
+    struct arena_chunk *next;
+
+    for (chunk = arena->chunks; chunk; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    memset(arena, 0, sizeof(*arena));
+}
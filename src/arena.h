@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+
+//
+// bump allocator for entries that live as long as their map: nothing is
+// freed but all at once, and keys take exactly their length.
+//
+struct arena_chunk;
+
+struct arena {
+    struct arena_chunk *chunks; /* the current one first */
+    size_t used;                /* of the current chunk */
+    size_t bytes;               /* handed out, for accounting */
+    size_t reserved;            /* malloc()ed, for accounting */
+};
+
+void* arena_alloc(struct arena *arena, size_t size);
+char* arena_strndup(struct arena *arena, const char *str, size_t len);
+void free_arena(struct arena *arena);
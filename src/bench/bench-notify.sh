@@ -0,0 +1,59 @@
+#!/bin/bash
+#
+# opens/sec of the notification engine (-u) against the number of
+# supervisor threads (-j). NPROC processes keep opening a file that
+# lives in the sandbox, so every open() is served by a supervisor.
+#
+
+DIR=$(cd $(dirname "$0")/..; pwd)
+NPROC=${NPROC:-$(nproc)}
+NOPEN=${NOPEN:-20000}
+THREADS=${THREADS:-"1 2 4 8 16"}
+TMP=$(mktemp -d /tmp/bench-notify-XXXX)
+
+cat > $TMP/opens.c <<EOF
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+int main(int argc, char *argv[])
+{
+    int i, p, nproc = atoi(argv[1]), nopen = atoi(argv[2]);
+    struct timeval beg, end;
+
+    /* written, so it only exists in the sandbox */
+    close(open("file", O_CREAT | O_WRONLY | O_TRUNC, 0644));
+
+    gettimeofday(&beg, NULL);
+    for (p = 0; p < nproc; p ++) {
+        if (fork() == 0) {
+            for (i = 0; i < nopen; i ++) {
+                close(open("file", O_RDONLY));
+            }
+            exit(0);
+        }
+    }
+    while (wait(NULL) > 0);
+    gettimeofday(&end, NULL);
+
+    double sec = (end.tv_sec - beg.tv_sec) + (end.tv_usec - beg.tv_usec) / 1e6;
+    printf("%.0f\n", nproc * nopen / sec);
+    return 0;
+}
+EOF
+cc -O2 -o $TMP/opens $TMP/opens.c || exit 1
+
+echo "# $NPROC procs x $NOPEN opens"
+echo "# threads opens/sec"
+for j in $THREADS; do
+  rm -rf $TMP/root
+  mkdir $TMP/root
+  printf "%9d " $j
+  (cd $TMP; $DIR/mbox -i -u -j $j -r $TMP/root -- ./opens $NPROC $NOPEN) \
+    2>/dev/null | tail -1
+done
+
+rm -rf $TMP
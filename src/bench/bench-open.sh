@@ -0,0 +1,82 @@
+#!/bin/bash
+#
+# per-call cost of deciding where an open() goes: loops of open() of a
+# host file by an absolute path, by a path relative to the cwd, and by
+# a path relative to a dirfd (openat), with nothing to rewrite.
+#
+# the wall time per call is mostly the stops; the user time the tracer
+# spends per call (the total less the tracee's own) is the decision.
+#
+
+DIR=$(cd $(dirname "$0")/..; pwd)
+NCALL=${NCALL:-200000}
+MODES=${MODES:-"native ptrace -s"}
+TMP=$(mktemp -d /tmp/bench-open-XXXX)
+
+mkdir -p $TMP/a/b/c/d
+touch $TMP/a/b/c/d/file
+
+cat > $TMP/opens.c <<EOF2
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+int main(int argc, char *argv[])
+{
+    int i, fd, n = atoi(argv[3]);
+    int dirfd = open(".", O_RDONLY | O_DIRECTORY);
+    struct timeval beg, end;
+    struct rusage ru;
+
+    gettimeofday(&beg, NULL);
+    for (i = 0; i < n; i ++) {
+        if (strcmp(argv[1], "openat") == 0)
+            fd = openat(dirfd, argv[2], O_RDONLY);
+        else
+            fd = open(argv[2], O_RDONLY);
+        close(fd);
+    }
+    gettimeofday(&end, NULL);
+
+    getrusage(RUSAGE_SELF, &ru);
+
+    double usec = (end.tv_sec - beg.tv_sec) * 1e6 + (end.tv_usec - beg.tv_usec);
+    double user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+    printf("%.3f %.3f\n", usec / n, user);
+    return 0;
+}
+EOF2
+cc -O2 -o $TMP/opens $TMP/opens.c || exit 1
+
+echo "# $NCALL calls"
+echo "# mode     call    usec/call  tracer-user-nsec/call"
+cd $TMP/a/b
+for m in $MODES; do
+  for c in "abs open $TMP/a/b/c/d/file" "rel open ./c/../c/d/file" "at openat c/d/file"; do
+    set -- $c
+    rm -rf $TMP/root
+    mkdir $TMP/root
+    case $m in
+      native) cmd="" ;;
+      ptrace) cmd="$DIR/mbox -i -r $TMP/root --" ;;
+      *)      cmd="$DIR/mbox -i $m -r $TMP/root --" ;;
+    esac
+    # user time of the tracer and the tracee, as waited for
+    TIMEFORMAT=%U
+    { time $cmd $TMP/opens $2 $3 $NCALL 2>/dev/null | tail -1 > $TMP/out; } 2> $TMP/user
+    set -- $1 $(cat $TMP/out) $(cat $TMP/user)
+    if [ $# -eq 4 ]; then
+      r=$(awk "BEGIN { printf \"%-10s %.0f\", $2, ($4 - $3) * 1e9 / $NCALL }")
+    else
+      r=
+    fi
+    printf "%-10s %-7s %s\n" "$m" "$1" "${r:-failed}"
+  done
+done
+
+cd /
+rm -rf $TMP
@@ -0,0 +1,37 @@
+#!/bin/bash
+#
+# rm -rf of a large host tree in the sandbox: every unlink() and
+# rmdir() marks a path deleted, and every rmdir() folds the deleted
+# paths below it, so this stresses the deleted map (fsmap).
+#
+
+DIR=$(cd $(dirname "$0")/..; pwd)
+NDIR=${NDIR:-100}
+NFILE=${NFILE:-1000}
+MODES=${MODES:-"native ptrace -s"}
+TMP=$(mktemp -d /tmp/bench-rm-rf-XXXX)
+
+mkdir $TMP/tree
+for d in $(seq $NDIR); do
+  mkdir $TMP/tree/d$d
+  (cd $TMP/tree/d$d; seq -f "f%g" $NFILE | xargs touch)
+done
+
+echo "# $NDIR dirs x $NFILE files"
+echo "# mode     sec"
+for m in $MODES; do
+  rm -rf $TMP/root $TMP/root.meta $TMP/root.journal
+  mkdir $TMP/root
+  [ $m = native ] && cp -a $TMP/tree $TMP/copy
+  beg=$(date +%s.%N)
+  case $m in
+    native) rm -rf $TMP/copy; r=$? ;;
+    ptrace) $DIR/mbox -i -r $TMP/root -- rm -rf $TMP/tree >/dev/null 2>&1; r=$? ;;
+    *)      $DIR/mbox -i $m -r $TMP/root -- rm -rf $TMP/tree >/dev/null 2>&1; r=$? ;;
+  esac
+  end=$(date +%s.%N)
+  [ $r -eq 0 ] && r=$(awk "BEGIN { printf \"%.2f\", $end - $beg }") || r=
+  printf "%-10s %s\n" "$m" "${r:-failed}"
+done
+
+rm -rf $TMP
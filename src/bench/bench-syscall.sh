@@ -0,0 +1,62 @@
+#!/bin/bash
+#
+# per-syscall cost of the tracer's stop path: loops of stat() on a
+# host file (entry stop only under -s) and of unlink() on a missing
+# file (entry and exit stops), with nothing to rewrite.
+#
+
+DIR=$(cd $(dirname "$0")/..; pwd)
+NCALL=${NCALL:-200000}
+MODES=${MODES:-"native ptrace -s"}
+TMP=$(mktemp -d /tmp/bench-syscall-XXXX)
+
+cat > $TMP/stats.c <<EOF2
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+int main(int argc, char *argv[])
+{
+    int i, n = atoi(argv[2]);
+    struct stat st;
+    struct timeval beg, end;
+
+    gettimeofday(&beg, NULL);
+    for (i = 0; i < n; i ++) {
+        if (strcmp(argv[1], "stat") == 0)
+            stat("/etc/passwd", &st);
+        else
+            unlink("nosuchfile");
+    }
+    gettimeofday(&end, NULL);
+
+    double usec = (end.tv_sec - beg.tv_sec) * 1e6 + (end.tv_usec - beg.tv_usec);
+    printf("%.3f\n", usec / n);
+    return 0;
+}
+EOF2
+cc -O2 -o $TMP/stats $TMP/stats.c || exit 1
+
+echo "# $NCALL calls"
+echo "# mode     syscall usec/call"
+for m in $MODES; do
+  for sc in stat unlink; do
+    rm -rf $TMP/root
+    mkdir $TMP/root
+    case $m in
+      native) r=$($TMP/stats $sc $NCALL) ;;
+      ptrace) r=$($DIR/mbox -i -r $TMP/root -- $TMP/stats $sc $NCALL 2>/dev/null) ;;
+      *)      r=$($DIR/mbox -i $m -r $TMP/root -- $TMP/stats $sc $NCALL 2>/dev/null) ;;
+    esac
+    # an aborted run (the tracer or the loop killed) times nothing
+    if [ $? -ne 0 ] || [[ ! $r =~ ^[0-9]+\.[0-9]+$ ]]; then
+      r=aborted
+    fi
+    printf "%-10s %-7s %s\n" "$m" "$sc" "$r"
+  done
+done
+
+rm -rf $TMP
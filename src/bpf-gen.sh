@@ -1,17 +1,21 @@
 #!/bin/bash
 
-cat <<EOF
+cat <<EOF2
 #pragma once
 
 static struct sock_filter filter[] = {
     LD_SYSCALL,
-EOF
+EOF2
 
+# close() and friends are not stopped at, an fd is checked once used
+# instead (see. sbox_fd_valid()), and lseek() only to the d_off of a
+# merged listing (see. sbox_lseek())
 cat linux/syscall.h| grep sbox_ \
-    | sed -e 's/int sbox_/    TRACE_SYSCALL(/g' -e 's/();/),/g'
+    | grep -v -e 'sbox_close' -e 'sbox_dup[23]' \
+    | sed -e 's/int sbox_lseek();/    TRACE_SYSCALL_ARG_HI(lseek, 1, SBOX_DENTS_OFF >> 32),/' \
+          -e 's/int sbox_/    TRACE_SYSCALL(/g' -e 's/();/),/g'
 
-cat <<EOF
+cat <<EOF2
     ALLOWED,
 };
-EOF
-
+EOF2
@@ -15,8 +15,12 @@ static struct sock_filter filter[] = {
     TRACE_SYSCALL(access),
     TRACE_SYSCALL(faccessat),
     TRACE_SYSCALL(getdents),
+    TRACE_SYSCALL(getdents64),
+    TRACE_SYSCALL_ARG_HI(lseek, 1, SBOX_DENTS_OFF >> 32),
     TRACE_SYSCALL(getcwd),
     TRACE_SYSCALL(chdir),
+    TRACE_SYSCALL(fchdir),
+    TRACE_SYSCALL(unshare),
     TRACE_SYSCALL(creat),
     TRACE_SYSCALL(utimensat),
     TRACE_SYSCALL(utime),
@@ -27,6 +31,8 @@ static struct sock_filter filter[] = {
     TRACE_SYSCALL(truncate),
     TRACE_SYSCALL(rename),
     TRACE_SYSCALL(renameat),
+    TRACE_SYSCALL(renameat2),
+    TRACE_SYSCALL(statx),
     TRACE_SYSCALL(link),
     TRACE_SYSCALL(symlink),
     TRACE_SYSCALL(readlink),
@@ -62,6 +68,6 @@ static struct sock_filter filter[] = {
     TRACE_SYSCALL(mprotect),
     TRACE_SYSCALL(mmap),
     TRACE_SYSCALL(mremap),
-    TRACE_SYSCALL(brk),
+    TRACE_SYSCALL(munmap),
     ALLOWED,
 };
@@ -18,6 +18,7 @@
 
 #define OFF_SYSCALL     (offsetof(struct seccomp_data, nr  ))
 #define OFF_ARCH        (offsetof(struct seccomp_data, arch))
+#define OFF_ARG_HI(n)   (offsetof(struct seccomp_data, args[n]) + 4)
 
 #define LD_SYSCALL                                      \
     BPF_STMT(BPF_LD+BPF_W+BPF_ABS, OFF_SYSCALL)
@@ -26,6 +27,14 @@
     BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, __NR_##name, 0, 1), \
     BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_TRACE)
 
+/* only if the upper half of arg n has any of bits (little-endian) */
+#define TRACE_SYSCALL_ARG_HI(name, n, bits)             \
+    BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, __NR_##name, 0, 4), \
+    BPF_STMT(BPF_LD+BPF_W+BPF_ABS, OFF_ARG_HI(n)),      \
+    BPF_JUMP(BPF_JMP+BPF_JSET+BPF_K, (bits), 0, 1),     \
+    BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_TRACE),         \
+    BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW)
+
 #define ALLOWED                                         \
     BPF_STMT(BPF_RET+BPF_K, SECCOMP_RET_ALLOW)
 
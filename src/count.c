@@ -100,8 +100,9 @@ time_cmp(void *a, void *b)
 static int
 syscall_cmp(void *a, void *b)
 {
-	return strcmp(sysent[*((int *) a)].sys_name,
-		      sysent[*((int *) b)].sys_name);
+	/* gaps of the syscall table have no name */
+	return strcmp(sysent[*((int *) a)].sys_name ? : "",
+		      sysent[*((int *) b)].sys_name ? : "");
 }
 
 static int
@@ -26,6 +26,8 @@
  enum { dbg_seccomp  = 1 };
  enum { dbg_profile  = 1 };
  enum { dbg_md5map   = 1 };
+ enum { dbg_store    = 1 };
+ enum { dbg_notify   = 1 };
 
 # define dbg(filter, msg, ...)                  \
     do {                                        \
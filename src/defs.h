@@ -62,6 +62,8 @@
 #include <sys/syscall.h>
 #include <sys/user.h>
 
+#include "uthash.h"
+
 #ifndef PATH_MAX
 # define PATH_MAX MAXPATHLEN
 #endif
@@ -353,6 +355,16 @@ struct systemlog {
 
 extern struct systemlog *systemlog;
 
+/*
+ * String args of a notified syscall (-u), each read from the tracee
+ * once: the checks of the sandbox and the syscall we perform see the
+ * same path, even if another thread of the tracee rewrites it.
+ */
+struct tcb_strs {
+    int ret[MAX_ARGS];             /* of umovestr(), or -2 if not read */
+    char buf[MAX_ARGS][PATH_MAX];
+};
+
 /* Trace Control Block */
 struct tcb {
     int flags;                     /* See below for TCB_ values */
@@ -383,15 +395,25 @@ struct tcb {
     struct user_regs_struct regs;  /* Registers fetched when entering */
     int hijacked;                  /* Wheither hijacked or not */
     int hijacked_args[MAX_ARGS+1]; /* Hijacked old argument */
-    int hijacked_vals[MAX_ARGS+1]; /* Hijacked old value */
+    long hijacked_vals[MAX_ARGS+1];/* Hijacked old value */
 
-    int dentfd_host;               /* FD for a getdent call on hostfs */
-    int dentfd_sbox;               /* Sandboxfs FD for the corresponding to hostfs */
-    char dentfd_spn[PATH_MAX];     /* Sandboxfs pathname */
+    struct sbox_call *call;        /* Path resolved at entry, or NULL */
 
-    long readonly_ptr;             /* Readonly memory ptr */
+    struct sbox_mm *mm;            /* Address space, shared by threads */
+    struct sbox_fs *fs;            /* Cwd, shared by CLONE_FS threads */
+    struct sbox_files *files;      /* Fd paths, shared by CLONE_FILES */
+    int pidfd;                     /* Of the tracee, or -1 */
+    struct tcb_strs *strs;         /* String args read once, or NULL */
+    int slot;                      /* Scratch slot of this syscall */
+    int slot_hint;                 /* Scratch slot used last time */
+    long stage_addr;               /* Where the staged strings go */
+    int stage_len;                 /* Bytes staged in this stop */
+    struct sbox_inject *inject;    /* Syscall injected, or NULL */
 
     struct auditlog *logs;         /* Auditing logs */
+
+    struct tcb *next_free;         /* Free list of tcbs */
+    UT_hash_handle hh;             /* Index of live tcbs, by pid */
 };
 
 /* TCB flags */
@@ -424,6 +446,9 @@ struct tcb {
 #define TCB_BPTSET  00100   /* "Breakpoint" set after fork(2) */
 #define TCB_REPRINT 00200   /* We should reprint this syscall on exit */
 #define TCB_FILTERED    00400   /* This system call has been filtered out */
+#define TCB_REGS_PARTIAL 02000  /* Only the syscall regs are in tcp->regs */
+#define TCB_REGS_DIRTY  04000   /* tcp->regs to be written back (PTRACE_SETREGS) */
+#define TCB_NOTIFY      010000  /* a seccomp notification, not a ptrace stop (-u) */
 /* x86 does not need TCB_WAITEXECVE.
  * It can detect SIGTRAP by looking at eax/rax.
  * See "not a syscall entry (eax = %ld)\n" message
@@ -491,6 +516,8 @@ extern const struct xlat open_access_modes[];
 #define TRACE_SIGNAL    020 /* Trace signal-related syscalls. */
 #define TRACE_DESC      040 /* Trace file descriptor-related syscalls. */
 #define SYSCALL_NEVER_FAILS 0100    /* Syscall is always successful. */
+#define SBOX_EXIT       0200 /* sbox handler works on syscall exit. */
+#define SBOX_EXIT_ROOT  0400 /* ... only if fakeroot (-R) is enabled. */
 
 typedef enum {
     CFLAG_NONE = 0,
@@ -515,12 +542,18 @@ extern char *opt_root;
 extern int opt_root_len;
 extern bool opt_seccomp;
 extern bool opt_interactive;
+extern bool opt_commit;
 extern bool opt_no_nw;
 extern bool opt_fakeroot;
 extern bool opt_md5;
+extern char *opt_digest;
+extern char *opt_store;
+extern bool opt_notify;
+extern int opt_notify_threads;
 
 extern void kill_all(struct tcb *tcp);
-extern int has_any_entering_proc(struct tcb *current);
+extern int sbox_syscall(struct tcb *tcp);
+extern int sbox_needs_exit(struct tcb *tcp);
 
 enum bitness_t { BITNESS_CURRENT = 0, BITNESS_32 };
 
@@ -578,7 +611,10 @@ typedef unsigned char byte;
 extern int setbpt(struct tcb *);
 extern int clearbpt(struct tcb *);
 extern int mkdirp(char *pn, mode_t mode);
-extern int copyfile(char *src, char *dst, byte *md5);
+struct digest;
+extern int copyfile(char *src, char *dst, const struct digest *alg, byte *digest);
+extern int clonefile(char *src, char *dst, mode_t mode);
+extern int clonefile_link(char *src, char *dst, mode_t mode);
 extern int exists_parent_dir(char *path);
 extern char kbhit(void);
 extern int normalize_path(char *name);
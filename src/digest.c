@@ -0,0 +1,117 @@
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "digest.h"
+
+extern void die_out_of_memory(void);
+
+#define DIGEST_BUF (256 << 10)     /* per read() of digest_fd() */
+
+static struct digest digests[] = {
+    { "sha256"    , "SHA256"    , 32, NULL },
+    { "blake2b512", "BLAKE2B512", 64, NULL },
+    { "sha1"      , "SHA1"      , 20, NULL },
+    { "md5"       , "MD5"       , 16, NULL },
+};
+
+/* NULL if unknown, or openssl doesn't have it */
+const struct digest *find_digest(const char *name)
+{
+    struct digest *alg;
+    size_t i;
+
+    for (i = 0; i < sizeof(digests) / sizeof(digests[0]); i ++) {
+        alg = &digests[i];
+        if (strcmp(alg->name, name) != 0) {
+            continue;
+        }
+        if (!alg->md) {
+            alg->md = EVP_get_digestbyname(alg->evp);
+        }
+        return alg->md ? alg : NULL;
+    }
+    return NULL;
+}
+
+EVP_MD_CTX *digest_begin(const struct digest *alg)
+{
+    EVP_MD_CTX *ctx = EVP_MD_CTX_new();
+
+    if (!ctx || !EVP_DigestInit_ex(ctx, alg->md, NULL)) {
+        die_out_of_memory();
+    }
+    return ctx;
+}
+
+void digest_update(EVP_MD_CTX *ctx, const void *buf, size_t len)
+{
+    EVP_DigestUpdate(ctx, buf, len);
+}
+
+void digest_end(EVP_MD_CTX *ctx, unsigned char *out)
+{
+    EVP_DigestFinal_ex(ctx, out, NULL);
+    EVP_MD_CTX_free(ctx);
+}
+
+/* hash [0, size) of fd to out, 1 if the whole of it was read */
+int digest_fd(const struct digest *alg, int fd, off_t size, unsigned char *out)
+{
+    EVP_MD_CTX *ctx = digest_begin(alg);
+    char *buf = malloc(DIGEST_BUF);
+    off_t off = 0;
+    ssize_t n = 0;
+
+    if (!buf) {
+        die_out_of_memory();
+    }
+
+    // holes read as zeros, as they should hash
+    posix_fadvise(fd, 0, size, POSIX_FADV_SEQUENTIAL);
+    while (off < size) {
+        n = pread(fd, buf, DIGEST_BUF, off);
+        if (n <= 0) {
+            break;
+        }
+        digest_update(ctx, buf, n);
+        off += n;
+    }
+    digest_end(ctx, out);
+    free(buf);
+
+    return off == size;
+}
+
+static
+void *digest_job_run(void *arg)
+{
+    struct digest_job *job = arg;
+
+    job->ret = digest_fd(job->alg, job->fd, job->size, job->out);
+    return NULL;
+}
+
+//
+// hash [0, size) of fd in a thread, 0 if it couldn't start one. fd is
+// only pread(), so the caller may go on using it (not closing it)
+// until digest_fd_wait().
+//
+int digest_fd_start(struct digest_job *job, const struct digest *alg,
+                    int fd, off_t size, unsigned char *out)
+{
+    job->alg = alg;
+    job->fd = fd;
+    job->size = size;
+    job->out = out;
+    job->ret = 0;
+
+    return pthread_create(&job->thread, NULL, digest_job_run, job) == 0;
+}
+
+/* 1 if the whole file was hashed */
+int digest_fd_wait(struct digest_job *job)
+{
+    pthread_join(job->thread, NULL);
+    return job->ret;
+}
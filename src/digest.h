@@ -0,0 +1,42 @@
+#pragma once
+
+#include <pthread.h>
+#include <sys/types.h>
+#include <openssl/evp.h>
+
+#define DIGEST_MAX_LEN     64
+#define DIGEST_DEFAULT     "sha256"
+
+//
+// digests of copied-up files (-m), by the name the meta file records.
+// sha256 is the default: on cpus with the sha extensions, it runs at
+// twice the speed of md5, and it is a content key fit for sharing.
+//
+struct digest {
+    const char *name;
+    const char *evp;               /* name of the openssl digest */
+    int len;
+    const EVP_MD *md;              /* fetched by find_digest() */
+};
+
+//
+// a file hashed by a thread of its own, e.g., while the copy runs in
+// the kernel (see copyfile())
+//
+struct digest_job {
+    const struct digest *alg;
+    int fd;
+    off_t size;
+    unsigned char *out;
+    int ret;                       /* 1 if hashed */
+    pthread_t thread;
+};
+
+const struct digest *find_digest(const char *name);
+EVP_MD_CTX *digest_begin(const struct digest *alg);
+void digest_update(EVP_MD_CTX *ctx, const void *buf, size_t len);
+void digest_end(EVP_MD_CTX *ctx, unsigned char *out);
+int digest_fd(const struct digest *alg, int fd, off_t size, unsigned char *out);
+int digest_fd_start(struct digest_job *job, const struct digest *alg,
+                    int fd, off_t size, unsigned char *out);
+int digest_fd_wait(struct digest_job *job);
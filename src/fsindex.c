@@ -0,0 +1,107 @@
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include "fsindex.h"
+
+extern void die_out_of_memory(void);
+
+static
+struct fsindex_node* alloc_node(struct fsindex *index, const char *name, int len)
+{
+    struct fsindex_node *s = arena_alloc(&index->arena, sizeof(struct fsindex_node));
+    memset(s, 0, sizeof(*s));
+    s->name = arena_strndup(&index->arena, name, len);
+    return s;
+}
+
+struct fsindex* alloc_fsindex(void)
+{
+    struct fsindex *index = (struct fsindex*)calloc(1, sizeof(struct fsindex));
+    if (!index) {
+        die_out_of_memory();
+    }
+    index->root.name = "";
+    return index;
+}
+
+static
+struct fsindex_node* find_child(struct fsindex_node *node, const char *name, int len)
+{
+    struct fsindex_node *s;
+    HASH_FIND(hh, node->children, name, len, s);
+    return s;
+}
+
+/* next component of the path: its length, and where it begins */
+static
+int next_component(const char **path)
+{
+    const char *beg = *path;
+    const char *end;
+
+    while (*beg == '/') {
+        beg ++;
+    }
+    for (end = beg; *end != '\0' && *end != '/'; end ++);
+
+    *path = beg;
+    return end - beg;
+}
+
+void add_path_to_fsindex(struct fsindex *index, const char *path, int flags)
+{
+    struct fsindex_node *node = &index->root;
+    struct fsindex_node *s;
+    int len;
+
+    while ((len = next_component(&path)) > 0) {
+        if (!(s = find_child(node, path, len))) {
+            s = alloc_node(index, path, len);
+            HASH_ADD_KEYPTR(hh, node->children, s->name, len, s);
+        }
+        node = s;
+        path += len;
+    }
+    node->flags |= flags;
+}
+
+int may_exist_in_fsindex(struct fsindex *index, const char *path)
+{
+    struct fsindex_node *node = &index->root;
+    int len;
+
+    while ((len = next_component(&path)) > 0) {
+        if (node->flags & INDEX_OPAQUE) {
+            return 1;
+        }
+        if (!(node = find_child(node, path, len))) {
+            return 0;
+        }
+        path += len;
+    }
+    return 1;
+}
+
+size_t fsindex_bytes(struct fsindex *index)
+{
+    return index->arena.reserved;
+}
+
+static
+void free_children(struct fsindex_node *node)
+{
+    struct fsindex_node *s;
+    struct fsindex_node *tmp;
+
+    HASH_ITER(hh, node->children, s, tmp) {
+        free_children(s);
+    }
+    HASH_CLEAR(hh, node->children);
+}
+
+void free_fsindex(struct fsindex *index)
+{
+    free_children(&index->root);
+    free_arena(&index->arena);
+    free(index);
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "uthash.h"
+#include "arena.h"
+
+//
+// paths that may exist in the sandboxfs, as a trie of path components.
+// a path not in the index surely doesn't exist, so looking it up saves
+// an access(); a path in the index still has to be checked.
+//
+#define INDEX_OPAQUE (1<<0)     /* anything below may exist as well */
+
+struct fsindex_node {
+    const char *name;           /* path component */
+    int flags;
+    struct fsindex_node *children;
+    UT_hash_handle hh;
+};
+
+struct fsindex {
+    struct fsindex_node root;
+    struct arena arena;         /* nodes and names */
+};
+
+struct fsindex* alloc_fsindex(void);
+void add_path_to_fsindex(struct fsindex *index, const char *path, int flags);
+int may_exist_in_fsindex(struct fsindex *index, const char *path);
+size_t fsindex_bytes(struct fsindex *index);
+void free_fsindex(struct fsindex *index);
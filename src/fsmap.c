@@ -1,72 +1,188 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
-#include <dirent.h>
+#include <limits.h>
 #include "fsmap.h"
 #include "dbg.h"
 
-struct fsmap* alloc_fsmap(void)
+extern void die_out_of_memory(void);
+
+static
+struct fsmap_node* alloc_node(struct fsmap *map, const char *name, int len)
 {
-    /* nothing to do */
-    return NULL;
+    struct fsmap_node *s = map->free;
+    char *buf = NULL;
+    int size = 0;
+    if (s) {
+        /* the free list is linked through children */
+        map->free = s->children;
+        /* keep the name storage if the new one fits */
+        if (len < s->size) {
+            buf = (char *)s->name;
+            size = s->size;
+        }
+    } else {
+        s = arena_alloc(&map->arena, sizeof(struct fsmap_node));
+    }
+    memset(s, 0, sizeof(*s));
+    if (buf) {
+        memcpy(buf, name, len);
+        buf[len] = '\0';
+    } else {
+        buf = arena_strndup(&map->arena, name, len);
+        size = len + 1;
+    }
+    s->name = buf;
+    s->size = size;
+    return s;
 }
 
-void add_path_to_fsmap(struct fsmap **map, char *key, int val)
+struct fsmap* alloc_fsmap(void)
 {
-    struct fsmap* s = (struct fsmap*)malloc(sizeof(struct fsmap));
-    strncpy(s->key, key, sizeof(s->key));
-    s->val = val;
-    HASH_ADD_STR(*map, key, s);
-
-    dbg(fsmap, "deleted %s (flag:%d)", key, val);
+    struct fsmap *map = (struct fsmap*)calloc(1, sizeof(struct fsmap));
+    if (!map) {
+        die_out_of_memory();
+    }
+    map->root.name = "";
+    return map;
 }
 
-struct fsmap* get_path_from_fsmap(struct fsmap *map, char *key)
+static
+struct fsmap_node* find_child(struct fsmap_node *node, const char *name, int len)
 {
-    struct fsmap *s;
-    HASH_FIND_STR(map, key, s);
+    struct fsmap_node *s;
+    HASH_FIND(hh, node->children, name, len, s);
     return s;
 }
 
-void free_fsmap(struct fsmap *map)
+/* next component of the path: its length, and where it begins */
+static
+int next_component(const char **path)
 {
-    struct fsmap *s;
-    struct fsmap *tmp;
+    const char *beg = *path;
+    const char *end;
 
-    HASH_ITER(hh, map, s, tmp) {
-        HASH_DEL(map, s);
-        free(s);
+    while (*beg == '/') {
+        beg ++;
     }
+    for (end = beg; *end != '\0' && *end != '/'; end ++);
+
+    *path = beg;
+    return end - beg;
 }
 
-int is_deleted(struct fsmap *map, char *path)
+static
+struct fsmap_node* lookup_node(struct fsmap *map, const char *key, int create)
 {
-    if (!map) {
-        return 0;
-    }
-    
-    char buf[PATH_MAX];
-    strncpy(buf, path, sizeof(buf));
-    
-    struct fsmap *s;
-    char *end = buf + strlen(buf);
-    do {
-        dbg(fsmapv, "path: %s", buf);
-        s = get_path_from_fsmap(map, buf);
-        if (s) {
-            switch (s->val) {
-            case PATH_DELETED:
-                return 1;
-            case PATH_ALLOWED:
-                return 0;
+    struct fsmap_node *node = &map->root;
+    struct fsmap_node *s;
+    int len;
+
+    while ((len = next_component(&key)) > 0) {
+        if (!(s = find_child(node, key, len))) {
+            if (!create) {
+                return NULL;
             }
+            s = alloc_node(map, key, len);
+            HASH_ADD_KEYPTR(hh, node->children, s->name, len, s);
         }
+        node = s;
+        key += len;
+    }
+    return node;
+}
+
+void add_path_to_fsmap(struct fsmap *map, const char *key, int val)
+{
+    lookup_node(map, key, 1)->val = val;
+
+    dbg(fsmap, "deleted %s (flag:%d)", key, val);
+}
+
+/* put the nodes below on the free list, names and all */
+static
+void free_children(struct fsmap *map, struct fsmap_node *node)
+{
+    struct fsmap_node *s;
+    struct fsmap_node *tmp;
 
-        while (end != buf && *end != '/') {
-            end --;
+    HASH_ITER(hh, node->children, s, tmp) {
+        free_children(map, s);
+        s->children = map->free;
+        map->free = s;
+    }
+    HASH_CLEAR(hh, node->children);
+}
+
+/* forget whatever is marked below key (not key itself) */
+void prune_fsmap(struct fsmap *map, const char *key)
+{
+    struct fsmap_node *node = lookup_node(map, key, 0);
+    if (node) {
+        dbg(fsmap, "merging deleted files under: %s", key);
+        free_children(map, node);
+    }
+}
+
+static
+void walk_node(struct fsmap_node *node, char *path, int len, fsmap_fn fn, void *arg)
+{
+    struct fsmap_node *s;
+    struct fsmap_node *tmp;
+
+    if (node->val) {
+        fn(len ? path : "/", node->val, arg);
+    }
+    HASH_ITER(hh, node->children, s, tmp) {
+        int n = snprintf(path + len, PATH_MAX - len, "/%s", s->name);
+        if (n < PATH_MAX - len) {
+            walk_node(s, path, len + n, fn, arg);
         }
-        *end = '\0';
-    } while (end != buf);
+    }
+    path[len] = '\0';
+}
+
+/* fn() on every marked path, parents first */
+void walk_fsmap(struct fsmap *map, fsmap_fn fn, void *arg)
+{
+    char path[PATH_MAX];
+
+    path[0] = '\0';
+    walk_node(&map->root, path, 0, fn, arg);
+}
+
+int is_empty_fsmap(struct fsmap *map)
+{
+    return !map->root.val && !map->root.children;
+}
+
+size_t fsmap_bytes(struct fsmap *map)
+{
+    return map->arena.reserved;
+}
+
+void free_fsmap(struct fsmap *map)
+{
+    free_children(map, &map->root);
+    free_arena(&map->arena);
+    free(map);
+}
+
+int is_deleted(struct fsmap *map, const char *path)
+{
+    struct fsmap_node *node = &map->root;
+    int val = node->val;
+    int len;
 
-    return 0;
-}
\ No newline at end of file
+    while ((len = next_component(&path)) > 0) {
+        dbg(fsmapv, "path: %.*s", len, path);
+        if (!(node = find_child(node, path, len))) {
+            break;
+        }
+        if (node->val) {
+            val = node->val;
+        }
+        path += len;
+    }
+    return val == PATH_DELETED;
+}
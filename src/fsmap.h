@@ -1,19 +1,36 @@
 #pragma once
 
 #include "uthash.h"
+#include "arena.h"
 
 #define PATH_DELETED (1<<0)
 #define PATH_ALLOWED (1<<1)
 
-struct fsmap {
-    char key[PATH_MAX];
-    int val;
+//
+// deleted/allowed paths, as a trie of path components. the nearest
+// marked ancestor (or the path itself) decides whether a path is deleted.
+//
+struct fsmap_node {
+    const char *name;           /* path component */
+    int size;                   /* of the storage behind name */
+    int val;                    /* PATH_DELETED, PATH_ALLOWED or 0 */
+    struct fsmap_node *children;
     UT_hash_handle hh;
 };
 
+struct fsmap {
+    struct fsmap_node root;
+    struct fsmap_node *free;    /* pruned nodes, reused before the arena */
+    struct arena arena;         /* nodes and names */
+};
+
+typedef void (*fsmap_fn)(const char *path, int val, void *arg);
+
 struct fsmap* alloc_fsmap(void);
-void add_path_to_fsmap(struct fsmap **map, char *key, int val);
-struct fsmap* get_path_from_fsmap(struct fsmap *map, char *key);
-int is_in_fsmap(struct fsmap *map, char *key);
+void add_path_to_fsmap(struct fsmap *map, const char *key, int val);
+void prune_fsmap(struct fsmap *map, const char *key);
+void walk_fsmap(struct fsmap *map, fsmap_fn fn, void *arg);
+int is_empty_fsmap(struct fsmap *map);
+size_t fsmap_bytes(struct fsmap *map);
 void free_fsmap(struct fsmap *map);
-int is_deleted(struct fsmap *map, char *path);
+int is_deleted(struct fsmap *map, const char *path);
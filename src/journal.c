@@ -0,0 +1,290 @@
+#include <err.h>
+#include <errno.h>
+#include <stddef.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "journal.h"
+
+extern void die_out_of_memory(void);
+
+#define JOURNAL_BUF   (64 << 10)   /* of a snapshot, per write() */
+#define JOURNAL_VAL   256          /* the largest value of a record */
+
+/* fnv-1a, enough to tell a torn record */
+static
+uint32_t journal_sum(uint32_t sum, const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+    size_t i;
+
+    for (i = 0; i < len; i ++) {
+        sum = (sum ^ p[i]) * 16777619u;
+    }
+    return sum;
+}
+
+/* the record of key/val in out, and its size */
+static
+size_t journal_fill(char *out, int type, const char *key,
+                    const void *val, int vallen)
+{
+    struct journal_rec rec;
+    size_t keylen = strlen(key);
+    char *p = out + sizeof(rec);
+
+    rec.type = type;
+    rec.keylen = keylen;
+    rec.vallen = vallen;
+
+    memcpy(p, key, keylen + 1);
+    memcpy(p + keylen + 1, val, vallen);
+    rec.sum = journal_sum(2166136261u, &rec.type,
+                          sizeof(rec) - offsetof(struct journal_rec, type));
+    rec.sum = journal_sum(rec.sum, p, keylen + 1 + vallen);
+    memcpy(out, &rec, sizeof(rec));
+
+    return sizeof(rec) + keylen + 1 + vallen;
+}
+
+void journal_init_hdr(struct journal_hdr *hdr, int kind, const char *alg)
+{
+    memset(hdr, 0, sizeof(*hdr));
+    memcpy(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic));
+    hdr->version = JOURNAL_VERSION;
+    hdr->kind = kind;
+    snprintf(hdr->alg, sizeof(hdr->alg), "%s", alg);
+}
+
+//
+// call fn on each record of path, from its mapping: the length of its
+// valid part (what follows is torn), 0 if it doesn't exist (or is
+// empty), or -1 if it is not of ours (e.g., the text .meta)
+//
+off_t journal_replay(const char *path, struct journal_hdr *hdr,
+                     long long *records, journal_fn fn, void *arg)
+{
+    struct journal_rec rec;
+    struct stat st;
+    char *map;
+    off_t off;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            err(1, "open %s", path);
+        }
+        return 0;
+    }
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    if (st.st_size < (off_t)sizeof(*hdr)) {
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        err(1, "mmap %s", path);
+    }
+    memcpy(hdr, map, sizeof(*hdr));
+    if (memcmp(hdr->magic, JOURNAL_MAGIC, sizeof(hdr->magic)) != 0) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    if (hdr->version > JOURNAL_VERSION) {
+        errx(1, "Unknown version of %s: %u", path, hdr->version);
+    }
+    hdr->alg[sizeof(hdr->alg) - 1] = '\0';
+
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+    for (off = sizeof(*hdr); off + (off_t)sizeof(rec) <= st.st_size; ) {
+        memcpy(&rec, map + off, sizeof(rec));
+
+        const char *key = map + off + sizeof(rec);
+        off_t len = sizeof(rec) + rec.keylen + 1 + rec.vallen;
+        if (off + len > st.st_size || key[rec.keylen] != '\0') {
+            break;
+        }
+        uint32_t sum = journal_sum(2166136261u, map + off + sizeof(rec.sum),
+                                   sizeof(rec) - sizeof(rec.sum));
+        if (journal_sum(sum, key, len - sizeof(rec)) != rec.sum) {
+            break;
+        }
+
+        fn(rec.type, key, key + rec.keylen + 1, rec.vallen, arg);
+        (*records) ++;
+        off += len;
+    }
+
+    munmap(map, st.st_size);
+    return off;
+}
+
+//
+// the journal to append to: valid is the length of what was replayed
+// from it, anything behind is torn and dropped; 0 if there is none yet
+//
+void journal_init(struct journal *j, const char *path, const char *alg,
+                  off_t valid, off_t due)
+{
+    j->fd = -1;
+    j->size = 0;
+    j->due = due;
+    j->records = 0;
+    j->usec = 0;
+    journal_init_hdr(&j->hdr, JOURNAL_LOG, alg);
+    snprintf(j->path, sizeof(j->path), "%s", path);
+    pthread_mutex_init(&j->lock, NULL);
+
+    if (valid > 0) {
+        j->fd = open(path, O_WRONLY | O_CLOEXEC);
+        if (j->fd < 0 || ftruncate(j->fd, valid) < 0
+            || lseek(j->fd, valid, SEEK_SET) < 0) {
+            err(1, "open %s", path);
+        }
+        j->size = valid;
+    }
+}
+
+void journal_append(struct journal *j, int type, const char *key,
+                    const void *val, int vallen)
+{
+    char buf[sizeof(struct journal_rec) + PATH_MAX + 1 + JOURNAL_VAL];
+    struct timespec beg, end;
+    size_t len;
+
+    if (vallen > JOURNAL_VAL || strlen(key) >= PATH_MAX) {
+        errx(1, "journal %s: record too large (%s)", j->path, key);
+    }
+    len = journal_fill(buf, type, key, val, vallen);
+
+    pthread_mutex_lock(&j->lock);
+    clock_gettime(CLOCK_MONOTONIC, &beg);
+    if (j->fd < 0) {
+        j->fd = open(j->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (j->fd < 0 || write(j->fd, &j->hdr, sizeof(j->hdr)) != sizeof(j->hdr)) {
+            err(1, "open %s", j->path);
+        }
+        j->size = sizeof(j->hdr);
+    }
+    if (write(j->fd, buf, len) != (ssize_t)len) {
+        err(1, "write %s", j->path);
+    }
+    j->size += len;
+    j->records ++;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    j->usec += (end.tv_sec - beg.tv_sec) * 1000000LL
+        + (end.tv_nsec - beg.tv_nsec) / 1000;
+    pthread_mutex_unlock(&j->lock);
+}
+
+/* all in a snapshot now, only the header is left */
+void journal_reset(struct journal *j, off_t due)
+{
+    pthread_mutex_lock(&j->lock);
+    if (j->fd >= 0 && j->size > (off_t)sizeof(j->hdr)) {
+        if (ftruncate(j->fd, sizeof(j->hdr)) < 0
+            || lseek(j->fd, sizeof(j->hdr), SEEK_SET) < 0) {
+            err(1, "truncate %s", j->path);
+        }
+        j->size = sizeof(j->hdr);
+    }
+    j->due = due;
+    pthread_mutex_unlock(&j->lock);
+}
+
+/* records were appended past due, by any thread */
+int journal_due(struct journal *j)
+{
+    int due;
+
+    pthread_mutex_lock(&j->lock);
+    due = j->size > j->due;
+    pthread_mutex_unlock(&j->lock);
+    return due;
+}
+
+/* no record since the last snapshot */
+int journal_empty(struct journal *j)
+{
+    int empty;
+
+    pthread_mutex_lock(&j->lock);
+    empty = j->size <= (off_t)sizeof(j->hdr);
+    pthread_mutex_unlock(&j->lock);
+    return empty;
+}
+
+static
+void journal_flush(struct journal_writer *w)
+{
+    if (write(w->fd, w->buf, w->len) != w->len) {
+        w->failed = 1;
+    }
+    w->size += w->len;
+    w->len = 0;
+}
+
+int journal_create(struct journal_writer *w, const char *path, const char *alg)
+{
+    struct journal_hdr hdr;
+
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    snprintf(w->tmp, sizeof(w->tmp), "%s.tmp", path);
+    w->fd = open(w->tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd < 0) {
+        warn("open %s", w->tmp);
+        return 0;
+    }
+    w->buf = malloc(JOURNAL_BUF);
+    if (!w->buf) {
+        die_out_of_memory();
+    }
+    w->size = 0;
+    w->records = 0;
+    w->failed = 0;
+
+    journal_init_hdr(&hdr, JOURNAL_SNAPSHOT, alg);
+    memcpy(w->buf, &hdr, sizeof(hdr));
+    w->len = sizeof(hdr);
+    return 1;
+}
+
+void journal_put(struct journal_writer *w, int type, const char *key,
+                 const void *val, int vallen)
+{
+    if (vallen > JOURNAL_VAL || strlen(key) >= PATH_MAX) {
+        errx(1, "journal %s: record too large (%s)", w->path, key);
+    }
+    if (w->len + sizeof(struct journal_rec) + PATH_MAX + 1 + JOURNAL_VAL
+        > JOURNAL_BUF) {
+        journal_flush(w);
+    }
+    w->len += journal_fill(w->buf + w->len, type, key, val, vallen);
+    w->records ++;
+}
+
+/* on the disk before it replaces the old one, 0 if it couldn't */
+int journal_commit(struct journal_writer *w)
+{
+    journal_flush(w);
+    int ret = !w->failed && fsync(w->fd) == 0;
+
+    free(w->buf);
+    if (close(w->fd) < 0 || !ret || rename(w->tmp, w->path) < 0) {
+        warn("write %s", w->path);
+        unlink(w->tmp);
+        return 0;
+    }
+    return 1;
+}
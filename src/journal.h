@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+//
+// binary records of the sandbox metadata (deleted paths, digests of
+// the original files and changed paths): a snapshot (<root>.meta),
+// written at once from the maps, and a journal (<root>.journal) of
+// what was appended since, as it happened. both begin with the same
+// header. a load maps them, and replays their records in place, up to
+// the first torn one (a crash in the middle of an append).
+//
+#define JOURNAL_MAGIC      "MBOXMETA"
+#define JOURNAL_VERSION    4       /* 1 and 2 were the text .meta */
+
+#define JOURNAL_SNAPSHOT   0
+#define JOURNAL_LOG        1
+
+struct journal_hdr {
+    char magic[8];
+    uint32_t version;
+    uint32_t kind;                 /* JOURNAL_SNAPSHOT or JOURNAL_LOG */
+    char alg[16];                  /* digest of the records, by name */
+};
+
+//
+// a record: the header, then the key (a path) with its '\0', so it is
+// used right from the mapping, and the value
+//
+struct journal_rec {
+    uint32_t sum;                  /* of all that follows it */
+    uint16_t type;
+    uint16_t keylen;               /* without its '\0' */
+    uint32_t vallen;
+};
+
+typedef void (*journal_fn)(int type, const char *key, const void *val,
+                           int vallen, void *arg);
+
+//
+// the journal appended to, opened on the first record: a record is a
+// single write(), and never fsync()ed, so a crash of ours keeps all
+// of them (not one of the system, though). it is emptied by each
+// snapshot, so a load replays at most due bytes of it on top.
+//
+struct journal {
+    int fd;                        /* -1 until the first record */
+    off_t size;
+    off_t due;                     /* a snapshot, once size is past it */
+    struct journal_hdr hdr;
+    char path[PATH_MAX];
+    pthread_mutex_t lock;
+
+    long long records;             /* appended in this run */
+    long long usec;                /* spent appending them */
+};
+
+/* a snapshot, written aside and renamed over the old one */
+struct journal_writer {
+    int fd;
+    int len;                       /* buffered */
+    int failed;                    /* a write() of it failed */
+    char *buf;
+    long long size;
+    long long records;
+    char path[PATH_MAX];
+    char tmp[PATH_MAX];
+};
+
+void journal_init_hdr(struct journal_hdr *hdr, int kind, const char *alg);
+off_t journal_replay(const char *path, struct journal_hdr *hdr,
+                     long long *records, journal_fn fn, void *arg);
+void journal_init(struct journal *j, const char *path, const char *alg,
+                  off_t valid, off_t due);
+void journal_append(struct journal *j, int type, const char *key,
+                    const void *val, int vallen);
+int journal_due(struct journal *j);
+int journal_empty(struct journal *j);
+void journal_reset(struct journal *j, off_t due);
+int journal_create(struct journal_writer *w, const char *path, const char *alg);
+void journal_put(struct journal_writer *w, int type, const char *key,
+                 const void *val, int vallen);
+int journal_commit(struct journal_writer *w);
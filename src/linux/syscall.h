@@ -393,8 +393,16 @@ int sbox_unlinkat();
 int sbox_access();
 int sbox_faccessat();
 int sbox_getdents();
+int sbox_getdents64();
+int sbox_lseek();
 int sbox_getcwd();
 int sbox_chdir();
+int sbox_fchdir();
+int sbox_close();
+int sbox_dup2();
+int sbox_dup3();
+int sbox_close_range();
+int sbox_unshare();
 int sbox_creat();
 int sbox_utimensat();
 int sbox_utime();
@@ -405,6 +413,8 @@ int sbox_execve();
 int sbox_truncate();
 int sbox_rename();
 int sbox_renameat();
+int sbox_renameat2();
+int sbox_statx();
 int sbox_link();
 int sbox_symlink();
 int sbox_readlink();
@@ -443,4 +453,4 @@ int sbox_prctl();
 int sbox_mprotect();
 int sbox_mmap();
 int sbox_mremap();
-int sbox_brk();
+int sbox_munmap();
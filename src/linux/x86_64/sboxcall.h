@@ -1,16 +1,16 @@
 { 3,    TD,     sys_read,                   NULL,	"read"                           },  /* 0 */
 { 3,    TD,     sys_write,                  NULL,	"write"                          },  /* 1 */
 { 3,    TD|TF,  sys_open,                   sbox_open,          "open"               },  /* 2 */
-{ 1,    TD,     sys_close,                  NULL,	"close"                          },  /* 3 */
+{ 1,    TD,     sys_close,                  sbox_close,         "close"              },  /* 3 */
 { 2,    TF,     sys_stat,                   sbox_stat,          "stat"               },  /* 4 */
 { 2,    TD,     sys_fstat,                  NULL,	"fstat"                          },  /* 5 */
 { 2,    TF,     sys_lstat,                  sbox_stat,          "lstat"              },  /* 6 */
 { 3,    TD,     sys_poll,                   NULL,	"poll"                           },  /* 7 */
-{ 3,    TD,     sys_lseek,                  NULL,	"lseek"                          },  /* 8 */
+{ 3,    TD,     sys_lseek,                  sbox_lseek,         "lseek"              },  /* 8 */
 { 6,    TD,     sys_mmap,                   sbox_mmap,          "mmap"               },  /* 9 */
 { 3,    0,      sys_mprotect,               sbox_mprotect,      "mprotect"           },  /* 10 */
-{ 2,    0,      sys_munmap,                 NULL,	"munmap"                         },  /* 11 */
-{ 1,    0,      sys_brk,                    sbox_brk,           "brk"                },  /* 12 */
+{ 2,    0,      sys_munmap,                 sbox_munmap,        "munmap"             },  /* 11 */
+{ 1,    0,      sys_brk,                    NULL,	"brk"                            },  /* 12 */
 { 4,    TS,     sys_rt_sigaction,           NULL,	"rt_sigaction"                   },  /* 13 */
 { 4,    TS,     sys_rt_sigprocmask,         NULL,	"rt_sigprocmask"                 },  /* 14 */
 { 0,    TS,     sys_rt_sigreturn,           NULL,	"rt_sigreturn"                   },  /* 15 */
@@ -19,7 +19,7 @@
 { 5,    TD,     sys_pwrite,                 NULL,	"pwrite"                         },  /* 18 */
 { 3,    TD,     sys_readv,                  NULL,	"readv"                          },  /* 19 */
 { 3,    TD,     sys_writev,                 NULL,	"writev"                         },  /* 20 */
-{ 2,    TF,     sys_access,                 sbox_access,        "access"             },  /* 21 */
+{ 2,    TF|SR,  sys_access,                 sbox_access,        "access"             },  /* 21 */
 { 1,    TD,     sys_pipe,                   NULL,	"pipe"                           },  /* 22 */
 { 5,    TD,     sys_select,                 NULL,	"select"                         },  /* 23 */
 { 0,    0,      sys_sched_yield,            NULL,	"sched_yield"                    },  /* 24 */
@@ -31,7 +31,7 @@
 { 4,    TI,     sys_shmat,                  NULL,	"shmat"                          },  /* 30 */
 { 4,    TI,     sys_shmctl,                 NULL,	"shmctl"                         },  /* 31 */
 { 1,    TD,     sys_dup,                    NULL,	"dup"                            },  /* 32 */
-{ 2,    TD,     sys_dup2,                   NULL,	"dup2"                           },  /* 33 */
+{ 2,    TD,     sys_dup2,                   sbox_dup2,          "dup2"               },  /* 33 */
 { 0,    TS,     sys_pause,                  NULL,	"pause"                          },  /* 34 */
 { 2,    0,      sys_nanosleep,              NULL,	"nanosleep"                      },  /* 35 */
 { 2,    0,      sys_getitimer,              NULL,	"getitimer"                      },  /* 36 */
@@ -57,7 +57,7 @@
 { 5,    TP,     sys_clone,                  NULL,	"clone"                          },  /* 56 */
 { 0,    TP,     sys_fork,                   NULL,	"fork"                           },  /* 57 */
 { 0,    TP,     sys_vfork,                  NULL,	"vfork"                          },  /* 58 */
-{ 3,    TF|TP,  sys_execve,                 sbox_execve,        "execve"             },  /* 59 */
+{ 3,    TF|TP|SX, sys_execve,                 sbox_execve,        "execve"             },  /* 59 */
 { 1,    TP,     sys_exit,                   NULL,	"_exit"                          },  /* 60 */
 { 4,    TP,     sys_wait4,                  NULL,	"wait4"                          },  /* 61 */
 { 2,    TS,     sys_kill,                   NULL,	"kill"                           },  /* 62 */
@@ -76,23 +76,23 @@
 { 1,    TD,     sys_fdatasync,              NULL,   "fdatasync"                      },  /* 75 */
 { 2,    TF,     sys_truncate,               sbox_truncate,      "truncate"           },  /* 76 */
 { 2,    TD,     sys_ftruncate,              NULL,   "ftruncate"                      },  /* 77 */
-{ 3,    TD,     sys_getdents,               sbox_getdents,      "getdents"           },  /* 78 */
-{ 2,    TF,     sys_getcwd,                 sbox_getcwd,        "getcwd"             },  /* 79 */
-{ 1,    TF,     sys_chdir,                  sbox_chdir,         "chdir"              },  /* 80 */
-{ 1,    TD,     sys_fchdir,                 NULL,   "fchdir"                         },  /* 81 */
-{ 2,    TF,     sys_rename,                 sbox_rename,        "rename"             },  /* 82 */
+{ 3,    TD|SX,  sys_getdents,               sbox_getdents,      "getdents"           },  /* 78 */
+{ 2,    TF|SX,  sys_getcwd,                 sbox_getcwd,        "getcwd"             },  /* 79 */
+{ 1,    TF|SX,  sys_chdir,                  sbox_chdir,         "chdir"              },  /* 80 */
+{ 1,    TD|SX,  sys_fchdir,                 sbox_fchdir,        "fchdir"             },  /* 81 */
+{ 2,    TF|SX,  sys_rename,                 sbox_rename,        "rename"             },  /* 82 */
 { 2,    TF,     sys_mkdir,                  sbox_mkdir,         "mkdir"              },  /* 83 */
-{ 1,    TF,     sys_rmdir,                  sbox_rmdir,         "rmdir"              },  /* 84 */
+{ 1,    TF|SX,  sys_rmdir,                  sbox_rmdir,         "rmdir"              },  /* 84 */
 { 2,    TD|TF,  sys_creat,                  sbox_creat,         "creat"              },  /* 85 */
 { 2,    TF,     sys_link,                   sbox_link,          "link"               },  /* 86 */
-{ 1,    TF,     sys_unlink,                 sbox_unlink,        "unlink"             },  /* 87 */
+{ 1,    TF|SX,  sys_unlink,                 sbox_unlink,        "unlink"             },  /* 87 */
 { 2,    TF,     sys_symlink,                sbox_symlink,       "symlink"            },  /* 88 */
 { 3,    TF,     sys_readlink,               sbox_readlink,      "readlink"           },  /* 89 */
 { 2,    TF,     sys_chmod,                  sbox_chmod,         "chmod"              },  /* 90 */
 { 2,    TD,     sys_fchmod,                 NULL,   "fchmod"                         },  /* 91 */
-{ 3,    TF,     sys_chown,                  sbox_chown,         "chown"              },  /* 92 */
-{ 3,    TD,     sys_fchown,                 sbox_fchown,        "fchown"             },  /* 93 */
-{ 3,    TF,     sys_chown,                  sbox_lchown,        "lchown"             },  /* 94 */
+{ 3,    TF|SR,  sys_chown,                  sbox_chown,         "chown"              },  /* 92 */
+{ 3,    TD|SR,  sys_fchown,                 sbox_fchown,        "fchown"             },  /* 93 */
+{ 3,    TF|SR,  sys_chown,                  sbox_lchown,        "lchown"             },  /* 94 */
 { 1,    0,      sys_umask,                  NULL,   "umask"                          },  /* 95 */
 { 2,    0,      sys_gettimeofday,           NULL,   "gettimeofday"                   },  /* 96 */
 { 2,    0,      sys_getrlimit,              NULL,   "getrlimit"                      },  /* 97 */
@@ -100,13 +100,13 @@
 { 1,    0,      sys_sysinfo,                NULL,   "sysinfo"                        },  /* 99 */
 { 1,    0,      sys_times,                  NULL,   "times"                          },  /* 100 */
 { 4,    0,      sys_ptrace,                 NULL,   "ptrace"                         },  /* 101 */
-{ 0,    NF,     sys_getuid,                 sbox_getroot,       "getuid"             },  /* 102 */
+{ 0,    NF|SR,  sys_getuid,                 sbox_getroot,       "getuid"             },  /* 102 */
 { 3,    0,      sys_syslog,                 NULL,   "syslog"                         },  /* 103 */
-{ 0,    NF,     sys_getgid,                 sbox_getroot,       "getgid"             },  /* 104 */
+{ 0,    NF|SR,  sys_getgid,                 sbox_getroot,       "getgid"             },  /* 104 */
 { 1,    0,      sys_setuid,                 NULL,   "setuid"                         },  /* 105 */
 { 1,    0,      sys_setgid,                 NULL,   "setgid"                         },  /* 106 */
-{ 0,    NF,     sys_geteuid,                sbox_getroot,       "geteuid"            },  /* 107 */
-{ 0,    NF,     sys_getegid,                sbox_getroot,       "getegid"            },  /* 108 */
+{ 0,    NF|SR,  sys_geteuid,                sbox_getroot,       "geteuid"            },  /* 107 */
+{ 0,    NF|SR,  sys_getegid,                sbox_getroot,       "getegid"            },  /* 108 */
 { 2,    0,      sys_setpgid,                NULL,   "setpgid"                        },  /* 109 */
 { 0,    0,      sys_getppid,                NULL,   "getppid"                        },  /* 110 */
 { 0,    0,      sys_getpgrp,                NULL,   "getpgrp"                        },  /* 111 */
@@ -155,7 +155,7 @@
 { 3,    0,      sys_modify_ldt,             NULL,   "modify_ldt"                     },  /* 154 */
 { 2,    TF,     sys_pivotroot,              sbox_not_allowed,   "pivot_root"         },  /* 155 */
 { 1,    0,      sys_sysctl,                 NULL,   "_sysctl"                        },  /* 156 */
-{ 5,    0,      sys_prctl,                  sbox_prctl,         "prctl"              },  /* 157 */
+{ 5,    SX,     sys_prctl,                  sbox_prctl,         "prctl"              },  /* 157 */
 { 2,    TP,     sys_arch_prctl,             NULL,   "arch_prctl"                     },  /* 158 */
 { 1,    0,      sys_adjtimex,               NULL,   "adjtimex"                       },  /* 159 */
 { 2,    0,      sys_setrlimit,              NULL,   "setrlimit"                      },  /* 160 */
@@ -215,7 +215,7 @@
 { 4,    0,      printargs,                  NULL,   "epoll_ctl_old"                  },  /* 214 */
 { 4,    0,      printargs,                  NULL,   "epoll_wait_old"                 },  /* 215 */
 { 5,    0,      sys_remap_file_pages,       NULL,   "remap_file_pages"               },  /* 216 */
-{ 3,    TD,     sys_getdents64,             NULL,   "getdents64"                     },  /* 217 */
+{ 3,    TD|SX,  sys_getdents64,             sbox_getdents64,    "getdents64"         },  /* 217 */
 { 1,    0,      sys_set_tid_address,        NULL,   "set_tid_address"                },  /* 218 */
 { 0,    0,      sys_restart_syscall,        NULL,   "restart_syscall"                },  /* 219 */
 { 5,    TI,     sys_semtimedop,             NULL,   "semtimedop"                     },  /* 220 */
@@ -258,19 +258,19 @@
 { 4,    TD|TF,  sys_openat,                 sbox_openat,        "openat"             },  /* 257 */
 { 3,    TD|TF,  sys_mkdirat,                sbox_mkdirat,       "mkdirat"            },  /* 258 */
 { 4,    TD|TF,  sys_mknodat,                sbox_mknodat,       "mknodat"            },  /* 259 */
-{ 5,    TD|TF,  sys_fchownat,               sbox_fchownat,      "fchownat"           },  /* 260 */
+{ 5,    TD|TF|SR, sys_fchownat,               sbox_fchownat,      "fchownat"           },  /* 260 */
 { 3,    TD|TF,  sys_futimesat,              sbox_futimesat,     "futimesat"          },  /* 261 */
 { 4,    TD|TF,  sys_newfstatat,             sbox_newfstatat,    "newfstatat"         },  /* 262 */
-{ 3,    TD|TF,  sys_unlinkat,               sbox_unlinkat,      "unlinkat"           },  /* 263 */
-{ 4,    TD|TF,  sys_renameat,               sbox_renameat,      "renameat"           },  /* 264 */
+{ 3,    TD|TF|SX, sys_unlinkat,               sbox_unlinkat,      "unlinkat"           },  /* 263 */
+{ 4,    TD|TF|SX, sys_renameat,               sbox_renameat,      "renameat"           },  /* 264 */
 { 5,    TD|TF,  sys_linkat,                 sbox_linkat,        "linkat"             },  /* 265 */
 { 3,    TD|TF,  sys_symlinkat,              sbox_symlinkat,     "symlinkat"          },  /* 266 */
 { 4,    TD|TF,  sys_readlinkat,             sbox_readlinkat,    "readlinkat"         },  /* 267 */
 { 3,    TD|TF,  sys_fchmodat,               sbox_fchmodat,      "fchmodat"           },  /* 268 */
-{ 3,    TD|TF,  sys_faccessat,              sbox_faccessat,     "faccessat"          },  /* 269 */
+{ 3,    TD|TF|SR, sys_faccessat,              sbox_faccessat,     "faccessat"          },  /* 269 */
 { 6,    TD,     sys_pselect6,               NULL,   "pselect6"                       },  /* 270 */
 { 5,    TD,     sys_ppoll,                  NULL,   "ppoll"                          },  /* 271 */
-{ 1,    TP,     sys_unshare,                NULL,   "unshare"                        },  /* 272 */
+{ 1,    TP|SX,  sys_unshare,                sbox_unshare,       "unshare"            },  /* 272 */
 { 2,    0,      sys_set_robust_list,        NULL,   "set_robust_list"                },  /* 273 */
 { 3,    0,      sys_get_robust_list,        NULL,   "get_robust_list"                },  /* 274 */
 { 6,    TD,     sys_splice,                 NULL,   "splice"                         },  /* 275 */
@@ -290,7 +290,7 @@
 { 4,    TD|TS,  sys_signalfd4,              NULL,   "signalfd4"                      },  /* 289 */
 { 2,    TD,     sys_eventfd2,               NULL,   "eventfd2"                       },  /* 290 */
 { 1,    TD,     sys_epoll_create1,          NULL,   "epoll_create1"                  },  /* 291 */
-{ 3,    TD,     sys_dup3,                   NULL,   "dup3"                           },  /* 292 */
+{ 3,    TD,     sys_dup3,                   sbox_dup3,          "dup3"               },  /* 292 */
 { 2,    TD,     sys_pipe2,                  NULL,   "pipe2"                          },  /* 293 */
 { 1,    TD,     sys_inotify_init1,          NULL,   "inotify_init1"                  },  /* 294 */
 { 5,    TD,     sys_preadv,                 NULL,   "preadv"                         },  /* 295 */
@@ -310,3 +310,26 @@
 { 3,    0,      sys_getcpu,                 NULL,   "getcpu"                         },  /* 309 */
 { 6,    0,      sys_process_vm_readv,       NULL,   "process_vm_readv"               },  /* 310 */
 { 6,    0,      sys_process_vm_writev,      NULL,   "process_vm_writev"              },  /* 311 */
+{ 5,    0,      printargs,                  NULL,   "kcmp"                           },  /* 312 */
+{ 3,    TD,     printargs,                  NULL,   "finit_module"                   },  /* 313 */
+{ 3,    0,      printargs,                  NULL,   "sched_setattr"                  },  /* 314 */
+{ 4,    0,      printargs,                  NULL,   "sched_getattr"                  },  /* 315 */
+{ 5,    TD|TF|SX, sys_renameat,               sbox_renameat2,     "renameat2"          },  /* 316 */
+{ 3,    0,      printargs,                  NULL,   "seccomp"                        },  /* 317 */
+{ 3,    0,      printargs,                  NULL,   "getrandom"                      },  /* 318 */
+{ 2,    0,      printargs,                  NULL,   "memfd_create"                   },  /* 319 */
+{ 5,    TD,     printargs,                  NULL,   "kexec_file_load"                },  /* 320 */
+{ 3,    0,      printargs,                  NULL,   "bpf"                            },  /* 321 */
+{ 5,    TD|TF,  printargs,                  NULL,   "execveat"                       },  /* 322 */
+{ 1,    TD,     printargs,                  NULL,   "userfaultfd"                    },  /* 323 */
+{ 2,    0,      printargs,                  NULL,   "membarrier"                     },  /* 324 */
+{ 3,    0,      printargs,                  NULL,   "mlock2"                         },  /* 325 */
+{ 6,    TD,     printargs,                  NULL,   "copy_file_range"                },  /* 326 */
+{ 6,    TD,     printargs,                  NULL,   "preadv2"                        },  /* 327 */
+{ 6,    TD,     printargs,                  NULL,   "pwritev2"                       },  /* 328 */
+{ 4,    0,      printargs,                  NULL,   "pkey_mprotect"                  },  /* 329 */
+{ 2,    0,      printargs,                  NULL,   "pkey_alloc"                     },  /* 330 */
+{ 1,    0,      printargs,                  NULL,   "pkey_free"                      },  /* 331 */
+{ 5,    TD|TF,  printargs,                  sbox_statx,         "statx"              },  /* 332 */
+/* [333 ... 435] are neither decoded nor interposed */
+[436] = { 3,    TD,     printargs,          sbox_close_range,   "close_range"        },  /* 436 */
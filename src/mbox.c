@@ -42,12 +42,15 @@
 #include <grp.h>
 #include <dirent.h>
 #include <sys/utsname.h>
+#include <sys/syscall.h>
+#include <linux/kcmp.h>
 #if defined(IA64)
 # include <asm/ptrace_offsets.h>
 #endif
 
 #include "bpf.h"
 #include "bpf-syscall.h"
+#include "notify.h"
 
 /* In some libc, these aren't declared. Do it ourself: */
 extern char **environ;
@@ -101,9 +104,14 @@ int opt_root_len = 0;
 char *opt_test = NULL;
 bool opt_seccomp     = 0;
 bool opt_interactive = 1;
+bool opt_commit      = 0;
 bool opt_no_nw       = 0;
 bool opt_fakeroot    = 0;
 bool opt_md5         = 0;
+char *opt_digest     = NULL;
+char *opt_store      = NULL;
+bool opt_notify      = 0;
+int opt_notify_threads = 1;
 char *opt_profile    = NULL;
 
 /*
@@ -159,7 +167,8 @@ static FILE *shared_log;
 struct tcb *printing_tcp = NULL;
 static struct tcb *current_tcp;
 
-static struct tcb **tcbtab;
+static struct tcb *tcbhash;             /* live tcbs, indexed by pid */
+static struct tcb *tcbfree;             /* free list of tcbs */
 static unsigned int nprocs, tcbtabsize;
 static const char *progname;
 
@@ -221,7 +230,10 @@ usage: sandbox [-r root] [-s] [PROG]\n\
         -S sort : sort syscall counts by: time, calls, name, nothing (default %s)\n\
         -E var  : put var=val in the environment for command\n\
 \n\
-        -m      : keep md5 of original files\n\
+        -m      : keep digests of original files\n\
+        -M alg  : digest to keep with -m: sha256 (default), blake2b512, sha1 or md5\n\
+        -K dir  : share copied-up files with other sandboxes through a store in dir,\n\
+                  by their digest (implies -m, needs a reflink fs, e.g., btrfs or xfs)\n\
         -c      : count time, calls, and errors for each syscall and report summary\n\
         -d      : enable syscall trace to stderr\n\
         -D      : enable debug\n\
@@ -230,7 +242,10 @@ usage: sandbox [-r root] [-s] [PROG]\n\
         -n      : disable network accesses\n\
         -S      : enable nested seccomp\n\
         -i      : disable interactive session at the end\n\
+        -a      : commit all changes to the hostfs at the end, without asking\n\
         -s      : use seccomp instead of ptrace\n\
+        -u      : use seccomp user notification, and seccomp for the rest\n\
+        -j num  : number of threads to handle notifications with -u (default:1)\n\
         -R      : fakeroot\n\
         -C path : change directory\n\
         -r path : sandbox root (default:%s)\n",
@@ -286,6 +301,7 @@ install_seccomp(void) {
         .filter = filter,
     };
 
+    sbox_relax_filter(filter, ARRAY_SIZE(filter));
     if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0)) {
         err(1, "prctl(NO_NEW_PRIVS)");
     }
@@ -628,54 +644,51 @@ newoutf(struct tcb *tcp)
 static void
 expand_tcbtab(void)
 {
-    /* Allocate some more TCBs and expand the table.
+    /* Allocate some more TCBs onto the free list.
        We don't want to relocate the TCBs because our
        callers have pointers and it would be a pain.
-       So tcbtab is a table of pointers.  Since we never
-       free the TCBs, we allocate a single chunk of many.  */
-    int i = tcbtabsize;
-    struct tcb *newtcbs = calloc(tcbtabsize, sizeof(newtcbs[0]));
-    struct tcb **newtab = realloc(tcbtab, tcbtabsize * 2 * sizeof(tcbtab[0]));
-    if (!newtab || !newtcbs)
+       Since we never free the TCBs, we allocate a single
+       chunk of as many as we have so far.  */
+    unsigned int i, n = tcbtabsize ? tcbtabsize : 32;
+    struct tcb *newtcbs = calloc(n, sizeof(newtcbs[0]));
+    if (!newtcbs)
         die_out_of_memory();
-    tcbtabsize *= 2;
-    tcbtab = newtab;
-    while (i < tcbtabsize)
-        tcbtab[i++] = newtcbs++;
+    tcbtabsize += n;
+    for (i = 0; i < n; i++) {
+        newtcbs[i].next_free = tcbfree;
+        tcbfree = &newtcbs[i];
+    }
 }
 
 static struct tcb *
 alloctcb(int pid)
 {
-    int i;
     struct tcb *tcp;
 
-    if (nprocs == tcbtabsize)
+    if (!tcbfree)
         expand_tcbtab();
 
-    for (i = 0; i < tcbtabsize; i++) {
-        tcp = tcbtab[i];
-        if ((tcp->flags & TCB_INUSE) == 0) {
-            memset(tcp, 0, sizeof(*tcp));
-            tcp->pid = pid;
-            tcp->flags = TCB_INUSE;
+    tcp = tcbfree;
+    tcbfree = tcp->next_free;
+
+    memset(tcp, 0, sizeof(*tcp));
+    tcp->pid = pid;
+    tcp->flags = TCB_INUSE;
 #if SUPPORTED_PERSONALITIES > 1
-            tcp->currpers = current_personality;
+    tcp->currpers = current_personality;
 #endif
-            tcp->dentfd_sbox = -1;
-            tcp->dentfd_host = -1;
-            tcp->readonly_ptr = -1;
-            tcp->logs = NULL;
-
-            sbox_get_readonly_ptr(tcp);
-
-            nprocs++;
-            if (debug_flag)
-                fprintf(stderr, "new tcb for pid %d, active tcbs:%d\n", tcp->pid, nprocs);
-            return tcp;
-        }
-    }
-    error_msg_and_die("bug in alloctcb");
+    tcp->logs = NULL;
+    tcp->mm = sbox_new_mm();
+    tcp->fs = sbox_new_fs();
+    tcp->files = sbox_new_files();
+    tcp->pidfd = -1;
+    tcp->slot = SLOT_NONE;
+    HASH_ADD_INT(tcbhash, pid, tcp);
+
+    nprocs++;
+    if (debug_flag)
+        fprintf(stderr, "new tcb for pid %d, active tcbs:%d\n", tcp->pid, nprocs);
+    return tcp;
 }
 
 static void
@@ -684,6 +697,7 @@ droptcb(struct tcb *tcp)
     if (tcp->pid == 0)
         return;
 
+    HASH_DEL(tcbhash, tcp);
     nprocs--;
     if (debug_flag)
         fprintf(stderr, "dropped tcb for pid %d, %d remain\n", tcp->pid, nprocs);
@@ -706,18 +720,16 @@ droptcb(struct tcb *tcp)
         printing_tcp = NULL;
 
     // pass it to the systemlog
-    if (tcp->logs) {
-        struct systemlog *log = \
-            (struct systemlog *) safe_malloc(sizeof(struct systemlog));
-        log->pid = tcp->pid;
-        log->next = systemlog;
-        log->logs = tcp->logs;
-
-        // bump
-        systemlog = log;
-    }
+    sbox_flush_logs(tcp);
+    sbox_free_call(tcp);
+    sbox_put_mm(tcp);
+    sbox_put_fs(tcp);
+    sbox_put_files(tcp);
+    sbox_put_pidfd(tcp);
 
     memset(tcp, 0, sizeof(*tcp));
+    tcp->next_free = tcbfree;
+    tcbfree = tcp;
 }
 
 /* detach traced process; continue with sig
@@ -890,6 +902,9 @@ startup_child(char **argv)
     if (stat(pathname, &statbuf) < 0) {
         perror_msg_and_die("Can't stat '%s'", filename);
     }
+    if (opt_notify) {
+        sbox_notify_prepare();
+    }
     strace_child = pid = fork();
     if (pid < 0) {
         perror_msg_and_die("fork");
@@ -904,7 +919,9 @@ startup_child(char **argv)
             if (ptrace(PTRACE_TRACEME, 0L, 0L, 0L) < 0) {
                 perror_msg_and_die("ptrace(PTRACE_TRACEME, ...)");
             }
-            if (opt_seccomp) {
+            if (opt_notify) {
+                sbox_notify_install();
+            } else if (opt_seccomp) {
                 install_seccomp();
             }
         }
@@ -958,6 +975,10 @@ startup_child(char **argv)
 
     /* We are the tracer */
 
+    if (opt_notify) {
+        sbox_notify_attach(pid);
+    }
+
     if (!daemonized_tracer) {
         if (!use_seize) {
             /* child did PTRACE_TRACEME, nothing to do in parent */
@@ -1297,7 +1318,6 @@ get_os_release(void)
 static void __attribute__ ((noinline))
 init(int argc, char *argv[])
 {
-    struct tcb *tcp;
     int c, i;
     struct sigaction sa;
 
@@ -1314,17 +1334,6 @@ init(int argc, char *argv[])
 
     os_release = get_os_release();
 
-    /* Allocate the initial tcbtab.  */
-    tcbtabsize = argc;  /* Surely enough for all -p args.  */
-    tcbtab = calloc(tcbtabsize, sizeof(tcbtab[0]));
-    if (!tcbtab)
-        die_out_of_memory();
-    tcp = calloc(tcbtabsize, sizeof(*tcp));
-    if (!tcp)
-        die_out_of_memory();
-    for (c = 0; c < tcbtabsize; c++)
-        tcbtab[c] = tcp++;
-
     shared_log = stderr;
     set_sortby(DEFAULT_SORTBY);
     set_personality(DEFAULT_PERSONALITY);
@@ -1335,8 +1344,8 @@ init(int argc, char *argv[])
 
     bool opt_test_flag = 0;
     while ((c = getopt(argc, argv,
-        "+bcdDhqvVxyzistnRm"
-        "e:o:O:S:E:I:C:r:p:")) != EOF) {
+        "+abcdDhqvVxyzistnRmu"
+        "e:o:O:S:E:I:C:r:p:j:M:K:")) != EOF) {
         switch (c) {
         case 'b':
             detach_on_execve = 1;
@@ -1397,6 +1406,9 @@ init(int argc, char *argv[])
         case 'i':
             opt_interactive = 0;
             break;
+        case 'a':
+            opt_commit = 1;
+            break;
         case 's':
             opt_seccomp = 1;
             ptrace_setoptions |= PTRACE_O_TRACESECCOMP;
@@ -1422,6 +1434,22 @@ init(int argc, char *argv[])
         case 'm':
             opt_md5 = 1;
             break;
+        case 'M':
+            opt_md5 = 1;
+            opt_digest = strdup(optarg);
+            break;
+        case 'K':
+            opt_md5 = 1;
+            opt_store = strdup(optarg);
+            break;
+        case 'u':
+            opt_notify = 1;
+            break;
+        case 'j':
+            opt_notify_threads = string_to_uint(optarg);
+            if (opt_notify_threads <= 0)
+                error_opt_arg(c, optarg);
+            break;
         case 'p':
             opt_profile = strdup(optarg);
             break;
@@ -1432,6 +1460,16 @@ init(int argc, char *argv[])
     }
     argv += optind;
 
+    if (opt_notify) {
+        if (opt_seccomp)
+            error_msg_and_die("-s and -u are mutually exclusive");
+        if (os_release < KERNEL_VERSION(5,9,0))
+            error_msg_and_die("-u requires Linux 5.9 or later");
+        /* what can't be notified is traced as under -s */
+        opt_seccomp = 1;
+        ptrace_setoptions |= PTRACE_O_TRACESECCOMP;
+    }
+
     acolumn_spaces = malloc(acolumn + 1);
     if (!acolumn_spaces)
         die_out_of_memory();
@@ -1505,6 +1543,8 @@ init(int argc, char *argv[])
         }
     }
 
+    opt_root_len = strlen(opt_root);
+
     // init sbox routines
     dbg(welcome, "Root %s", opt_root);
     sbox_init();
@@ -1515,8 +1555,6 @@ init(int argc, char *argv[])
         sbox_check_test_cond(opt_test, "pre");
     }
 
-    opt_root_len = strlen(opt_root);
-
     if (opt_profile) {
         sbox_load_profile(opt_profile);
     }
@@ -1527,6 +1565,7 @@ init(int argc, char *argv[])
        in the STARTUP_CHILD mode we kill the spawned process anyway.  */
     skip_startup_execve = 1;
     startup_child(argv);
+    sbox_raise_nofile();
 
     sigemptyset(&empty_set);
     sigemptyset(&blocked_set);
@@ -1572,25 +1611,70 @@ init(int argc, char *argv[])
 static struct tcb *
 pid2tcb(int pid)
 {
-    int i;
+    struct tcb *tcp;
 
     if (pid <= 0)
         return NULL;
 
-    for (i = 0; i < tcbtabsize; i++) {
-        struct tcb *tcp = tcbtab[i];
-        if (tcp->pid == pid && (tcp->flags & TCB_INUSE))
-            return tcp;
+    HASH_FIND_INT(tcbhash, &pid, tcp);
+    return tcp;
+}
+
+/*
+ * Does the child share the address space (kind == KCMP_VM), the cwd
+ * (KCMP_FS) or the fd table (KCMP_FILES) with its parent? Without
+ * kcmp(), guess it from the event: threads share all of them, vfork
+ * children only the address space.
+ */
+static int
+shares_with_parent(struct tcb *parent, struct tcb *child, int kind, int event)
+{
+    int ret = syscall(SYS_kcmp, parent->pid, child->pid, kind, 0, 0);
+
+    if (ret >= 0)
+        return ret == 0;
+    if (kind == KCMP_VM)
+        return event != PTRACE_EVENT_FORK;
+    return event == PTRACE_EVENT_CLONE;
+}
+
+/*
+ * The new child shares the address space, cwd and fds of its parent,
+ * or gets a copy of them: the scratch mapping doesn't have to be
+ * mapped again, nor the cwd and fd paths read from /proc.
+ */
+static void
+inherit_from_parent(struct tcb *parent, int event)
+{
+    unsigned long pid = 0;
+    struct tcb *child;
+
+    if (ptrace(PTRACE_GETEVENTMSG, parent->pid, NULL, (long) &pid) < 0
+        || pid == 0)
+        return;
+
+    child = pid2tcb(pid);
+    if (!child) {
+        /* Its first stop is yet to come, see trace() */
+        child = alloctcb(pid);
+        child->flags |= TCB_ATTACHED | TCB_STARTUP | post_attach_sigstop;
+        newoutf(child);
+        if (debug_flag)
+            fprintf(stderr, "Process %lu attached\n", pid);
     }
 
-    return NULL;
+    sbox_inherit_mm(child, parent,
+                    shares_with_parent(parent, child, KCMP_VM, event));
+    sbox_inherit_fs(child, parent,
+                    shares_with_parent(parent, child, KCMP_FS, event));
+    sbox_inherit_files(child, parent,
+                       shares_with_parent(parent, child, KCMP_FILES, event));
 }
 
 static void
 cleanup(void)
 {
-    int i;
-    struct tcb *tcp;
+    struct tcb *tcp, *tmp;
     int fatal_sig;
 
     /* 'interrupted' is a volatile object, fetch it only once */
@@ -1598,10 +1682,7 @@ cleanup(void)
     if (!fatal_sig)
         fatal_sig = SIGTERM;
 
-    for (i = 0; i < tcbtabsize; i++) {
-        tcp = tcbtab[i];
-        if (!(tcp->flags & TCB_INUSE))
-            continue;
+    HASH_ITER(hh, tcbhash, tcp, tmp) {
         if (debug_flag > 1)
             fprintf(stderr,
                 "cleanup: looking at pid %u\n", tcp->pid);
@@ -1641,6 +1722,8 @@ trace(void)
 
         if (interrupted)
             return 0;
+        if (opt_notify)
+            sbox_check_stop();
         if (interactive)
             sigprocmask(SIG_SETMASK, &empty_set, NULL);
 # ifdef __WALL
@@ -1733,7 +1816,12 @@ trace(void)
             fprintf(stderr, " [wait(0x%04x) = %u] %s%s\n", status, pid, buf, evbuf);
         }
 
-        if (opt_seccomp && event == PTRACE_EVENT_SECCOMP) {
+        /*
+         * Before 4.8, the seccomp stop precedes the syscall-entry stop,
+         * so resume into it and handle the syscall there.
+         */
+        if (opt_seccomp && event == PTRACE_EVENT_SECCOMP
+            && os_release < KERNEL_VERSION(4,8,0)) {
             if (ptrace(PTRACE_SYSCALL, pid, 0, 0) < 0) {
                 err(1, "failed to continue");
             }
@@ -1815,7 +1903,9 @@ trace(void)
             droptcb(tcp);
             /* Switch to the thread, reusing leader's outfile and pid */
             tcp = execve_thread;
+            HASH_DEL(tcbhash, tcp);
             tcp->pid = pid;
+            HASH_ADD_INT(tcbhash, pid, tcp);
             if (cflag != CFLAG_ONLY_STATS) {
                 printleader(tcp);
                 tprintf("+++ superseded by execve in pid %lu +++\n", old_pid);
@@ -1825,6 +1915,22 @@ trace(void)
         }
  dont_switch_tcbs:
 
+        /*
+         * A new address space: its scratch is mapped again lazily.
+         * O_CLOEXEC fds are closed, and the fd table is unshared.
+         */
+        if (event == PTRACE_EVENT_EXEC) {
+            sbox_put_mm(tcp);
+            tcp->mm = sbox_new_mm();
+            sbox_put_files(tcp);
+            tcp->files = sbox_new_files();
+        }
+
+        if (event == PTRACE_EVENT_FORK
+            || event == PTRACE_EVENT_VFORK
+            || event == PTRACE_EVENT_CLONE)
+            inherit_from_parent(tcp, event);
+
         if (event == PTRACE_EVENT_EXEC && detach_on_execve) {
             if (!skip_startup_execve)
                 detach(tcp);
@@ -1907,6 +2013,22 @@ trace(void)
 
         if (event != 0) {
             /* Ptrace event */
+            if (event == PTRACE_EVENT_SECCOMP) {
+                /*
+                 * Since 4.8, the seccomp stop comes after the (skipped)
+                 * syscall-entry stop, so it is our entry stop, and
+                 * PTRACE_SYSCALL from here leads to the exit stop.
+                 */
+                if (trace_syscall(tcp) < 0)
+                    continue;
+                /*
+                 * Entry-only syscalls are done: leave the syscall
+                 * state, so the tracee resumes with PTRACE_CONT.
+                 */
+                if (exiting(tcp) && !sbox_needs_exit(tcp))
+                    tcp->flags &= ~TCB_INSYSCALL;
+                goto restart_tracee_with_sig_0;
+            }
 #ifdef USE_SEIZE
             if (event == PTRACE_EVENT_STOP || event == PTRACE_EVENT_STOP1) {
                 /*
@@ -2046,13 +2168,11 @@ trace(void)
 
 void kill_all(struct tcb *me)
 {
-    int i;
-    struct tcb *tcp;
+    struct tcb *tcp, *tmp;
 
     // kill child first, not to be detached
-    for (i = 0; i < tcbtabsize; i++) {
-        tcp = tcbtab[i];
-        if (tcp->flags & TCB_INUSE && !(me->pid != tcp->pid)) {
+    HASH_ITER(hh, tcbhash, tcp, tmp) {
+        if (!me || tcp->pid != me->pid) {
             kill(tcp->pid, SIGTERM);
         }
     }
@@ -2062,36 +2182,30 @@ void kill_all(struct tcb *me)
     }
 }
 
-int has_any_entering_proc(struct tcb *current)
-{
-    int i;
-    for (i = 0; i < tcbtabsize; i++) {
-        struct tcb *t = tcbtab[i];
-        if ((t->flags & TCB_INUSE) && (t != current)) {
-            if (entering(t)) {
-                return 1;
-            }
-        }
-    }
-    return 0;
-}
-
 int
 main(int argc, char *argv[])
 {
     init(argc, argv);
 
-    /* Run main tracing loop */
+    /* Run main tracing loop, along with the notification workers */
+    if (opt_notify)
+        sbox_notify_start();
     if (trace() < 0)
         return 1;
+    if (opt_notify) {
+        sbox_check_stop();
+        sbox_notify_stop();
+    }
 
     /* Check test post condition */
     if (opt_test) {
         sbox_check_test_cond(opt_test, "post");
     }
 
-    /* Interactive */
-    if (opt_interactive) {
+    /* Commit, or ask what to */
+    if (opt_commit) {
+        sbox_commit();
+    } else if (opt_interactive) {
         sbox_interactive();
     }
 
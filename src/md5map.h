@@ -1,50 +1,58 @@
 #pragma once
 
 #include "uthash.h"
+#include "arena.h"
 #include "dbg.h"
 
-#include <openssl/md5.h>
+#include "digest.h"
 
-struct md5map {
-    char key[PATH_MAX];
-    unsigned char val[MD5_DIGEST_LENGTH];
+struct md5entry {
+    unsigned char val[DIGEST_MAX_LEN];
     UT_hash_handle hh;
+    char key[];
+};
+
+//
+// digests of copied-up files (md5sums, once), all by the same alg and
+// only dropped once committed: entries and their exact-length keys live
+// in the arena until exit.
+//
+struct md5map {
+    struct md5entry *entries;
+    struct arena arena;
+    const struct digest *alg;
 };
 
 static
-void add_md5_to_map(struct md5map **map, char *key, unsigned char *val)
+void add_md5_to_map(struct md5map *map, char *key, unsigned char *val)
 {
-    struct md5map* s = (struct md5map*)malloc(sizeof(struct md5map));
-    strncpy(s->key, key, sizeof(s->key));
-    memcpy(s->val, val, sizeof(s->val));
+    size_t len = strlen(key);
+    struct md5entry* s = arena_alloc(&map->arena, sizeof(struct md5entry) + len + 1);
+    memset(&s->hh, 0, sizeof(s->hh));
+    memcpy(s->key, key, len + 1);
+    memcpy(s->val, val, map->alg->len);
 
-    HASH_ADD_STR(*map, key, s);
+    HASH_ADD_KEYPTR(hh, map->entries, s->key, len, s);
 
     ifdbg(md5map, {
         int i;
-        dbg(md5map, "add md5: %s", key);
-        for (i = 0; i < MD5_DIGEST_LENGTH; i ++) {
+        dbg(md5map, "add %s: %s", map->alg->name, key);
+        for (i = 0; i < map->alg->len; i ++) {
             fprintf(stderr, "%02x", val[i]);
         }
     });
 }
 
 static
-struct md5map* get_md5_from_map(struct md5map *map, char *key)
+struct md5entry* get_md5_from_map(struct md5map *map, char *key)
 {
-    struct md5map *s;
-    HASH_FIND_STR(map, key, s);
+    struct md5entry *s;
+    HASH_FIND_STR(map->entries, key, s);
     return s;
 }
 
 static
-void free_md5map(struct md5map *map)
+size_t md5map_bytes(struct md5map *map)
 {
-    struct md5map *s;
-    struct md5map *tmp;
-
-    HASH_ITER(hh, map, s, tmp) {
-        HASH_DEL(map, s);
-        free(s);
-    }
+    return map->arena.reserved;
 }
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "uthash.h"
+#include "arena.h"
+
+struct nameentry {
+    UT_hash_handle hh;
+    char name[];
+};
+
+//
+// names of a directory, read once to merge another listing with it
+// (see. sbox_getdents()), or paths (the change log of the sandbox):
+// rarely dropped one by one (once committed), so entries and their
+// exact-length names live in the arena, until the set is freed.
+//
+struct nameset {
+    struct nameentry *entries;
+    struct arena arena;
+};
+
+static
+void add_name_to_set(struct nameset *set, const char *name, size_t len)
+{
+    struct nameentry *s = arena_alloc(&set->arena, sizeof(struct nameentry) + len + 1);
+    memset(&s->hh, 0, sizeof(s->hh));
+    memcpy(s->name, name, len + 1);
+
+    HASH_ADD_KEYPTR(hh, set->entries, s->name, len, s);
+}
+
+static
+int has_name_in_set(struct nameset *set, const char *name, size_t len)
+{
+    struct nameentry *s;
+    HASH_FIND(hh, set->entries, name, len, s);
+    return s != NULL;
+}
+
+/* its entry stays in the arena */
+static
+void del_name_from_set(struct nameset *set, const char *name, size_t len)
+{
+    struct nameentry *s;
+    HASH_FIND(hh, set->entries, name, len, s);
+    if (s) {
+        HASH_DEL(set->entries, s);
+    }
+}
+
+static
+void free_nameset(struct nameset *set)
+{
+    HASH_CLEAR(hh, set->entries);
+    free_arena(&set->arena);
+}
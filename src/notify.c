@@ -0,0 +1,840 @@
+//
+// seccomp user notification engine (-u)
+//
+// The child installs the generated filter (bpf-syscall.h) with
+// SECCOMP_RET_USER_NOTIF in place of SECCOMP_RET_TRACE for what we
+// can perform on its behalf, and hands the listener fd over to us.
+// Each notification is dispatched to the same sbox_*() handlers as
+// the ptrace engine through a transient tcb:
+//
+//  - nothing rewritten : the tracee continues the syscall on its own
+//                        (SECCOMP_USER_NOTIF_FLAG_CONTINUE)
+//  - path rewritten    : we perform the syscall on behalf of the tracee
+//                        and reply its result; open() & co. install
+//                        the resulting fd by SECCOMP_IOCTL_NOTIF_ADDFD
+//
+// so a syscall costs a single wakeup instead of two ptrace stops and
+// GETREGS/SETREGS pairs. Notifications are received by workers (-j N,
+// one by default) on their own and handled in parallel.
+//
+// NOTE. what we can't do on behalf of the tracee keeps its
+// SECCOMP_RET_TRACE, and the tracees are traced as under -s to handle
+// it on the main thread: execve() (it has to run the sandboxed file),
+// chdir()/fchdir() (to a dir of the sandboxfs), getdents (merged with
+// the hostfs) and getcwd() (the hostfs name of such a dir), but also
+// bind(), lseek() of a merged listing and the syscalls keeping the
+// scratch mapping of the hijacked paths. 32-bit syscalls (int 0x80)
+// are not interposed at all.
+//
+#include "defs.h"
+#include "sbox.h"
+#include "dbg.h"
+#include "bpf.h"
+#include "bpf-syscall.h"
+#include "notify.h"
+
+#include <err.h>
+#include <signal.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <utime.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/ioctl.h>
+#include <sys/statfs.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+
+#ifdef SECCOMP_IOCTL_NOTIF_ADDFD
+
+#ifndef SECCOMP_ADDFD_FLAG_SEND
+# define SECCOMP_ADDFD_FLAG_SEND (1UL << 1)
+#endif
+
+/* upper bound of variable-sized buffers (xattr values, readlink) */
+#define NOTIFY_BUF_MAX 65536
+
+/* how to marshal an argument when we perform the syscall */
+enum {
+    NA_INT = 0,  /* passed as is */
+    NA_MODE,     /* creation mode, masked by the tracee's umask */
+    NA_DIRFD,    /* dirfd, always AT_FDCWD since paths are made absolute */
+    NA_PATH,     /* pathname relative to cwd or the dirfd (ref) */
+    NA_STR,      /* plain string (xattr name, symlink target) */
+    NA_IN,       /* input buffer of 'size' bytes, or arg[ref] bytes */
+    NA_OUT,      /* output buffer of 'size' bytes, or arg[ref] bytes */
+};
+
+struct notify_arg {
+    int kind;
+    int size;
+    int ref;
+};
+
+/* notify_sc flags */
+#define NS_EMULATE   (1<<0) /* we can perform it on behalf of the tracee */
+#define NS_OPEN      (1<<1) /* returns an fd to be installed */
+#define NS_ENTRY     (1<<2) /* handler only peeks on entry */
+#define NS_EXIT      (1<<3) /* handler works on exit */
+#define NS_EXIT_ROOT (1<<4) /* handler works on exit if fakeroot */
+#define NS_ROOT      (1<<5) /* only interposed if fakeroot */
+#define NS_WRITE     (1<<6) /* never let the tracee do it on the hostfs */
+
+struct notify_sc {
+    int flags;
+    struct notify_arg args[MAX_ARGS];
+};
+
+#define I           { NA_INT  , 0, -1 }
+#define M           { NA_MODE , 0, -1 }
+#define D           { NA_DIRFD, 0, -1 }
+#define P(dirfd)    { NA_PATH , 0, dirfd }
+#define S           { NA_STR  , 0, -1 }
+#define IN(size)    { NA_IN   , size, -1 }
+#define INL(arg)    { NA_IN   , 0, arg }
+#define OUT(size)   { NA_OUT  , size, -1 }
+#define OUTL(arg)   { NA_OUT  , 0, arg }
+
+#define EMU         NS_EMULATE
+#define EMU_W       (NS_EMULATE | NS_WRITE)
+
+static const struct notify_sc notify_sc[] = {
+    [__NR_open]         = { EMU|NS_OPEN   , { P(-1), I, M } },
+    [__NR_openat]       = { EMU|NS_OPEN   , { D, P(0), I, M } },
+    [__NR_creat]        = { EMU|NS_OPEN   , { P(-1), M } },
+    [__NR_stat]         = { EMU           , { P(-1), OUT(sizeof(struct stat)) } },
+    [__NR_lstat]        = { EMU           , { P(-1), OUT(sizeof(struct stat)) } },
+    [__NR_newfstatat]   = { EMU           , { D, P(0), OUT(sizeof(struct stat)), I } },
+    [__NR_statx]        = { EMU           , { D, P(0), I, I, OUT(sizeof(struct statx)) } },
+    [__NR_mkdir]        = { EMU_W         , { P(-1), M } },
+    [__NR_mkdirat]      = { EMU_W         , { D, P(0), M } },
+    [__NR_rmdir]        = { EMU_W|NS_EXIT , { P(-1) } },
+    [__NR_unlink]       = { EMU_W|NS_EXIT , { P(-1) } },
+    [__NR_unlinkat]     = { EMU_W|NS_EXIT , { D, P(0), I } },
+    [__NR_access]       = { EMU|NS_EXIT_ROOT, { P(-1), I } },
+    [__NR_faccessat]    = { EMU|NS_EXIT_ROOT, { D, P(0), I } },
+    [__NR_utimensat]    = { EMU_W         , { D, P(0), IN(2 * sizeof(struct timespec)), I } },
+    [__NR_utime]        = { EMU_W         , { P(-1), IN(sizeof(struct utimbuf)) } },
+    [__NR_utimes]       = { EMU_W         , { P(-1), IN(2 * sizeof(struct timeval)) } },
+    [__NR_futimesat]    = { EMU_W         , { D, P(0), IN(2 * sizeof(struct timeval)) } },
+    [__NR_chmod]        = { EMU_W         , { P(-1), I } },
+    [__NR_fchmodat]     = { EMU_W         , { D, P(0), I } },
+    [__NR_chown]        = { EMU_W|NS_EXIT_ROOT, { P(-1), I, I } },
+    [__NR_lchown]       = { EMU_W|NS_EXIT_ROOT, { P(-1), I, I } },
+    [__NR_fchownat]     = { EMU_W|NS_EXIT_ROOT, { D, P(0), I, I, I } },
+    [__NR_truncate]     = { EMU_W         , { P(-1), I } },
+    [__NR_rename]       = { EMU_W         , { P(-1), P(-1) } },
+    [__NR_renameat]     = { EMU_W         , { D, P(0), D, P(2) } },
+    [__NR_renameat2]    = { EMU_W         , { D, P(0), D, P(2), I } },
+    [__NR_link]         = { EMU_W         , { P(-1), P(-1) } },
+    [__NR_linkat]       = { EMU_W         , { D, P(0), D, P(2), I } },
+    [__NR_symlink]      = { EMU_W         , { S, P(-1) } },
+    [__NR_symlinkat]    = { EMU_W         , { S, D, P(1) } },
+    [__NR_readlink]     = { EMU           , { P(-1), OUTL(2), I } },
+    [__NR_readlinkat]   = { EMU           , { D, P(0), OUTL(3), I } },
+    [__NR_mknod]        = { EMU_W         , { P(-1), M, I } },
+    [__NR_mknodat]      = { EMU_W         , { D, P(0), M, I } },
+    [__NR_statfs]       = { EMU           , { P(-1), OUT(sizeof(struct statfs)) } },
+    [__NR_acct]         = { EMU_W         , { P(-1) } },
+    [__NR_setxattr]     = { EMU_W         , { P(-1), S, INL(3), I, I } },
+    [__NR_lsetxattr]    = { EMU_W         , { P(-1), S, INL(3), I, I } },
+    [__NR_removexattr]  = { EMU_W         , { P(-1), S } },
+    [__NR_lremovexattr] = { EMU_W         , { P(-1), S } },
+    [__NR_getxattr]     = { EMU           , { P(-1), S, OUTL(3), I } },
+    [__NR_lgetxattr]    = { EMU           , { P(-1), S, OUTL(3), I } },
+    [__NR_listxattr]    = { EMU           , { P(-1), OUTL(2), I } },
+    [__NR_llistxattr]   = { EMU           , { P(-1), OUTL(2), I } },
+    [__NR_socket]       = { NS_ENTRY      , { I } },
+    [__NR_connect]      = { NS_ENTRY      , { I } },
+    [__NR_getuid]       = { EMU|NS_ROOT|NS_EXIT, { I } },
+    [__NR_getgid]       = { EMU|NS_ROOT|NS_EXIT, { I } },
+    [__NR_geteuid]      = { EMU|NS_ROOT|NS_EXIT, { I } },
+    [__NR_getegid]      = { EMU|NS_ROOT|NS_EXIT, { I } },
+};
+
+#undef I
+#undef M
+#undef D
+#undef P
+#undef S
+#undef IN
+#undef INL
+#undef OUT
+#undef OUTL
+#undef EMU
+#undef EMU_W
+
+//
+// per notification context, the tcb should be placed at the very
+// first to get back the context from the sbox_*() handlers.
+//
+struct notify_req {
+    struct tcb tcb;
+    char *paths[MAX_ARGS];           /* hijacked args, if not NULL */
+    int too_long;                    /* bits of the paths[] cut short */
+    char bufs[MAX_ARGS][PATH_MAX];
+    struct sbox_call call;           /* tcb.call, kept across the memset */
+    struct tcb_strs strs;            /* tcb.strs, the string args as read */
+};
+
+static struct seccomp_notif_sizes notify_sizes;
+static struct sock_filter notify_filter[ARRAY_SIZE(filter)];
+static int notify_sock[2] = {-1, -1}; /* to pass the listener over */
+static int notify_fd = -1;           /* listener */
+static bool notify_addfd_send = 1;   /* SECCOMP_ADDFD_FLAG_SEND (>= 5.14) */
+static volatile sig_atomic_t notify_done; /* workers should return */
+static pthread_t *notify_workers;    /* opt_notify_threads of them */
+static struct notify_req *notify_reqs;
+
+static
+const struct notify_sc *notify_lookup(int nr)
+{
+    const struct notify_sc *sc;
+
+    if (nr < 0 || nr >= ARRAY_SIZE(notify_sc)) {
+        return NULL;
+    }
+    sc = &notify_sc[nr];
+    if (sc->flags == 0 || ((sc->flags & NS_ROOT) && !opt_fakeroot)) {
+        return NULL;
+    }
+    return sc;
+}
+
+static
+int notify_needs_exit(const struct notify_sc *sc)
+{
+    return (sc->flags & NS_EXIT)
+        || ((sc->flags & NS_EXIT_ROOT) && opt_fakeroot);
+}
+
+//
+// derive our filter from the ptrace one: notify if we handle the
+// syscall, otherwise leave it to the ptrace engine
+//
+static
+void notify_build_filter(void)
+{
+    int i, nr = -1;
+
+    memcpy(notify_filter, filter, sizeof(filter));
+    for (i = 0; i < ARRAY_SIZE(notify_filter); i ++) {
+        struct sock_filter *ins = &notify_filter[i];
+        // the last jeq has the syscall number (not the jset of the
+        // lseek() arg)
+        if (ins->code == (BPF_JMP+BPF_JEQ+BPF_K)) {
+            nr = ins->k;
+        }
+        if (ins->code == (BPF_RET+BPF_K) && ins->k == SECCOMP_RET_TRACE
+            && notify_lookup(nr)) {
+            ins->k = SECCOMP_RET_USER_NOTIF;
+        }
+    }
+    sbox_relax_filter(notify_filter, ARRAY_SIZE(notify_filter));
+}
+
+void sbox_notify_prepare(void)
+{
+    notify_build_filter();
+
+    if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, notify_sock) < 0) {
+        err(1, "socketpair");
+    }
+}
+
+/* in the child: install the filter and pass the listener to the parent */
+void sbox_notify_install(void)
+{
+    struct sock_fprog prog = {
+        .len = (unsigned short)ARRAY_SIZE(notify_filter),
+        .filter = notify_filter,
+    };
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    char dummy = 0;
+    struct iovec iov = {
+        .iov_base = &dummy,
+        .iov_len = 1,
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = cbuf,
+        .msg_controllen = sizeof(cbuf),
+    };
+    struct cmsghdr *cmsg;
+    int listener;
+
+    close(notify_sock[0]);
+
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0)) {
+        err(1, "prctl(NO_NEW_PRIVS)");
+    }
+    listener = syscall(SYS_seccomp, SECCOMP_SET_MODE_FILTER,
+                       SECCOMP_FILTER_FLAG_NEW_LISTENER, &prog);
+    if (listener < 0) {
+        err(1, "seccomp(NEW_LISTENER)");
+    }
+
+    memset(cbuf, 0, sizeof(cbuf));
+    cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &listener, sizeof(int));
+
+    if (sendmsg(notify_sock[1], &msg, 0) < 0) {
+        err(1, "sendmsg(listener)");
+    }
+
+    close(listener);
+    close(notify_sock[1]);
+}
+
+/* in the parent: receive the listener of the child */
+void sbox_notify_attach(int pid)
+{
+    char cbuf[CMSG_SPACE(sizeof(int))];
+    char dummy;
+    struct iovec iov = {
+        .iov_base = &dummy,
+        .iov_len = 1,
+    };
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = cbuf,
+        .msg_controllen = sizeof(cbuf),
+    };
+    struct cmsghdr *cmsg;
+
+    close(notify_sock[1]);
+
+    if (recvmsg(notify_sock[0], &msg, 0) <= 0
+        || !(cmsg = CMSG_FIRSTHDR(&msg))
+        || cmsg->cmsg_type != SCM_RIGHTS) {
+        errx(1, "failed to receive the seccomp listener of pid=%d", pid);
+    }
+    memcpy(&notify_fd, CMSG_DATA(cmsg), sizeof(int));
+    close(notify_sock[0]);
+
+    dbg(notify, "listener fd=%d (pid=%d)", notify_fd, pid);
+}
+
+void sbox_notify_hijack_str(struct tcb *tcp, int arg, char *new, int len)
+{
+    struct notify_req *req = (struct notify_req *)tcp;
+
+    // the kernel would refuse it, and so does notify_marshal()
+    if (len >= PATH_MAX) {
+        req->too_long |= 1 << arg;
+        len = PATH_MAX - 1;
+    }
+    memcpy(req->bufs[arg], new, len);
+    req->bufs[arg][len] = '\0';
+    req->paths[arg] = req->bufs[arg];
+}
+
+static
+int notify_remote_write(int pid, long ptr, void *buf, size_t len)
+{
+    struct iovec local[1], remote[1];
+
+    local[0].iov_base  = buf;
+    local[0].iov_len   = len;
+    remote[0].iov_base = (void *)ptr;
+    remote[0].iov_len  = len;
+
+    if (process_vm_writev(pid, local, 1, remote, 1, 0) != (ssize_t)len) {
+        return -1;
+    }
+    return 0;
+}
+
+//
+// NOTE. our own umask still applies on top of it, which only matters
+// if the tracee runs with a looser umask than us.
+//
+static
+mode_t notify_umask(int pid)
+{
+    char proc[64];
+    char line[256];
+    unsigned int mask = 022;
+
+    snprintf(proc, sizeof(proc), "/proc/%d/status", pid);
+    FILE *fp = fopen(proc, "r");
+    if (!fp) {
+        return mask;
+    }
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "Umask: %o", &mask) == 1) {
+            break;
+        }
+    }
+    fclose(fp);
+
+    return mask;
+}
+
+static
+void notify_init_tcb(struct notify_req *req, struct seccomp_notif *notif)
+{
+    struct tcb *tcp = &req->tcb;
+    int i;
+
+    memset(tcp, 0, sizeof(*tcp));
+    tcp->flags = TCB_INUSE | TCB_NOTIFY;
+    tcp->call = &req->call;
+    tcp->pidfd = -1;
+    tcp->strs = &req->strs;
+    tcp->pid = notif->pid;
+    tcp->scno = notif->data.nr;
+    tcp->u_nargs = MAX_ARGS;
+    req->too_long = 0;
+    for (i = 0; i < MAX_ARGS; i ++) {
+        tcp->u_arg[i] = notif->data.args[i];
+        req->paths[i] = NULL;
+        req->strs.ret[i] = -2;
+    }
+    tcp->regs.orig_rax = notif->data.nr;
+    tcp->regs.rip = notif->data.instruction_pointer;
+    tcp->regs.rdi = notif->data.args[0];
+    tcp->regs.rsi = notif->data.args[1];
+    tcp->regs.rdx = notif->data.args[2];
+    tcp->regs.r10 = notif->data.args[3];
+    tcp->regs.r8  = notif->data.args[4];
+    tcp->regs.r9  = notif->data.args[5];
+}
+
+//
+// read a path arg that is not rewritten and make it absolute by
+// resolving it through /proc/pid/{cwd,fd/#} of the tracee; it is the
+// copy the sandbox checked (see. struct tcb_strs), not read again
+//
+static
+long notify_read_path(struct tcb *tcp, const struct notify_arg *a, int i, char *out)
+{
+    char pn[PATH_MAX];
+    int n;
+
+    switch (umovestr(tcp, tcp->u_arg[i], PATH_MAX, pn)) {
+    case -1:
+        return -EFAULT;
+    case 0:
+        return -ENAMETOOLONG;
+    }
+
+    if (a->kind == NA_STR || pn[0] == '/' || pn[0] == '\0') {
+        n = snprintf(out, PATH_MAX, "%s", pn);
+    } else if (a->ref < 0 || (int)tcp->u_arg[a->ref] == AT_FDCWD) {
+        n = snprintf(out, PATH_MAX, "/proc/%d/cwd/%s", tcp->pid, pn);
+    } else {
+        n = snprintf(out, PATH_MAX, "/proc/%d/fd/%d/%s", tcp->pid,
+                     (int)tcp->u_arg[a->ref], pn);
+    }
+    if (n >= PATH_MAX) {
+        return -ENAMETOOLONG;
+    }
+    return 0;
+}
+
+static
+long notify_marshal(struct notify_req *req, const struct notify_arg *a,
+                    int i, long *arg, void **buf, size_t *len)
+{
+    struct tcb *tcp = &req->tcb;
+    const long ptr = tcp->u_arg[i];
+    size_t size;
+
+    switch (a->kind) {
+    case NA_INT:
+        *arg = ptr;
+        break;
+
+    case NA_MODE:
+        *arg = ptr & ~notify_umask(tcp->pid);
+        break;
+
+    case NA_DIRFD:
+        *arg = AT_FDCWD;
+        break;
+
+    case NA_PATH:
+    case NA_STR:
+        *arg = 0;
+        if (req->too_long & (1 << i)) {
+            return -ENAMETOOLONG;
+        }
+        if (req->paths[i]) {
+            *arg = (long)req->paths[i];
+            break;
+        }
+        if (ptr == 0) {
+            break;
+        }
+        *buf = safe_malloc(PATH_MAX);
+        *arg = (long)*buf;
+        return notify_read_path(tcp, a, i, *buf);
+
+    case NA_IN:
+    case NA_OUT:
+        *arg = 0;
+        if (ptr == 0) {
+            break;
+        }
+        size = a->size;
+        if (!size) {
+            size = tcp->u_arg[a->ref];
+            if (size > NOTIFY_BUF_MAX) {
+                if (a->kind == NA_IN) {
+                    return -E2BIG;
+                }
+                size = NOTIFY_BUF_MAX;
+            }
+        }
+        if (size == 0) {
+            break;
+        }
+        *buf = safe_malloc(size);
+        *arg = (long)*buf;
+        *len = size;
+        if (a->kind == NA_IN && umoven(tcp, ptr, size, *buf) < 0) {
+            return -EFAULT;
+        }
+        break;
+    }
+    return 0;
+}
+
+//
+// perform the syscall on behalf of the tracee, with the hijacked
+// paths in place of its args
+//
+static
+long notify_emulate(struct notify_req *req, const struct notify_sc *sc)
+{
+    struct tcb *tcp = &req->tcb;
+    long args[MAX_ARGS];
+    void *bufs[MAX_ARGS] = {NULL};
+    size_t lens[MAX_ARGS] = {0};
+    long ret = 0;
+    int i;
+
+    for (i = 0; i < MAX_ARGS && ret == 0; i ++) {
+        ret = notify_marshal(req, &sc->args[i], i, &args[i], &bufs[i], &lens[i]);
+    }
+    // buffers might be shrunk
+    for (i = 0; i < MAX_ARGS && ret == 0; i ++) {
+        if (sc->args[i].kind == NA_OUT && sc->args[i].size == 0 && bufs[i]) {
+            args[sc->args[i].ref] = lens[i];
+        }
+    }
+
+    if (ret == 0) {
+        ret = syscall(tcp->scno, args[0], args[1], args[2],
+                      args[3], args[4], args[5]);
+        if (ret < 0) {
+            ret = -errno;
+        }
+    }
+
+    // copy results back to the tracee
+    for (i = 0; i < MAX_ARGS; i ++) {
+        if (ret >= 0 && sc->args[i].kind == NA_OUT && bufs[i]) {
+            size_t len = sc->args[i].size ? lens[i] : ret;
+            if (len && notify_remote_write(tcp->pid, tcp->u_arg[i], bufs[i], len) < 0) {
+                ret = -EFAULT;
+            }
+        }
+        free(bufs[i]);
+    }
+
+    dbg(notify, "%s() = %ld", sysent[tcp->scno].sys_name, ret);
+    return ret;
+}
+
+//
+// a write to the path that we didn't rewrite (e.g., unreadable at
+// the moment), fail it rather than the kernel redoing it on hostfs
+//
+static
+long notify_check_unrewritten(struct notify_req *req, const struct notify_sc *sc)
+{
+    struct tcb *tcp = &req->tcb;
+    char pn[PATH_MAX];
+    int i;
+
+    for (i = 0; i < MAX_ARGS; i ++) {
+        if (sc->args[i].kind != NA_PATH || tcp->u_arg[i] == 0) {
+            continue;
+        }
+        if (umovestr(tcp, tcp->u_arg[i], PATH_MAX, pn) <= 0) {
+            return -EFAULT;
+        }
+        return -ENOENT;
+    }
+    return 0;
+}
+
+static
+int notify_oflag(struct tcb *tcp)
+{
+    switch (tcp->scno) {
+    case __NR_open:
+        return tcp->u_arg[1];
+    case __NR_openat:
+        return tcp->u_arg[2];
+    }
+    return 0;
+}
+
+/* return 1 if the response was sent along with the fd */
+static
+int notify_addfd(struct seccomp_notif *notif, struct seccomp_notif_resp *resp,
+                 int srcfd, int oflag)
+{
+    struct seccomp_notif_addfd addfd = {
+        .id = notif->id,
+        .flags = SECCOMP_ADDFD_FLAG_SEND,
+        .srcfd = srcfd,
+        .newfd = 0,
+        .newfd_flags = oflag & O_CLOEXEC,
+    };
+    int fd;
+
+    if (notify_addfd_send) {
+        if (ioctl(notify_fd, SECCOMP_IOCTL_NOTIF_ADDFD, &addfd) >= 0) {
+            return 1;
+        }
+        if (errno != EINVAL) {
+            resp->error = -errno;
+            return 0;
+        }
+        // older kernels: add the fd and reply separately
+        notify_addfd_send = 0;
+    }
+
+    addfd.flags = 0;
+    fd = ioctl(notify_fd, SECCOMP_IOCTL_NOTIF_ADDFD, &addfd);
+    if (fd < 0) {
+        resp->error = -errno;
+    } else {
+        resp->val = fd;
+    }
+    return 0;
+}
+
+/* return 1 if the response was already sent */
+static
+int notify_handle(struct notify_req *req, struct seccomp_notif *notif,
+                  struct seccomp_notif_resp *resp)
+{
+    struct tcb *tcp = &req->tcb;
+    const struct notify_sc *sc;
+    int sent = 0;
+    long ret;
+
+    resp->id = notif->id;
+    resp->val = 0;
+    resp->error = 0;
+    resp->flags = SECCOMP_USER_NOTIF_FLAG_CONTINUE;
+
+    sc = notify_lookup(notif->data.nr);
+    if (notif->data.arch != AUDIT_ARCH_X86_64 || !sc) {
+        return 0;
+    }
+
+    notify_init_tcb(req, notif);
+    sbox_syscall(tcp);
+
+    if (sc->flags & NS_ENTRY) {
+        goto out;
+    }
+
+    if (!tcp->hijacked) {
+        if ((sc->flags & NS_WRITE)
+            && (ret = notify_check_unrewritten(req, sc)) < 0) {
+            resp->flags = 0;
+            resp->error = ret;
+            goto out;
+        }
+        if (!notify_needs_exit(sc)) {
+            goto out;
+        }
+    }
+
+    // all the args are fetched, make sure the tracee is still waiting
+    if (ioctl(notify_fd, SECCOMP_IOCTL_NOTIF_ID_VALID, &notif->id) < 0) {
+        goto out;
+    }
+
+    resp->flags = 0;
+    ret = notify_emulate(req, sc);
+
+    if (sc->flags & NS_OPEN) {
+        if (ret < 0) {
+            resp->error = ret;
+        } else {
+            sent = notify_addfd(notif, resp, ret, notify_oflag(tcp));
+            close(ret);
+        }
+        goto out;
+    }
+
+    // let the handler see the result, as on the syscall exit
+    tcp->flags |= TCB_INSYSCALL;
+    tcp->regs.rax = ret;
+    tcp->u_rval = ret;
+    tcp->u_error = ret < 0 ? -ret : 0;
+    if (notify_needs_exit(sc)) {
+        sbox_syscall(tcp);
+        ret = tcp->regs.rax;
+    }
+
+    if (ret < 0) {
+        resp->error = ret;
+    } else {
+        resp->val = ret;
+    }
+
+out:
+    sbox_flush_logs(tcp);
+    sbox_put_pidfd(tcp);
+    return sent;
+}
+
+static
+void notify_serve(struct notify_req *req, struct seccomp_notif *notif,
+                  struct seccomp_notif_resp *resp)
+{
+    memset(resp, 0, notify_sizes.seccomp_notif_resp);
+    if (!notify_handle(req, notif, resp)) {
+        if (ioctl(notify_fd, SECCOMP_IOCTL_NOTIF_SEND, resp) < 0
+            && errno != ENOENT) {
+            err(1, "ioctl(NOTIF_SEND)");
+        }
+    }
+}
+
+//
+// workers block in NOTIF_RECV on the listener. Once no tracee is left,
+// the main thread sets notify_done and kicks them out of the ioctl
+// with SIGURG, which only workers leave unblocked (and which is
+// ignored by default, so an external SIGURG still does nothing).
+//
+static
+void notify_wakeup(int sig)
+{
+}
+
+static
+void *notify_worker(void *arg)
+{
+    struct notify_req *req = arg;
+    struct seccomp_notif_resp *resp;
+    struct seccomp_notif *notif;
+    sigset_t urg;
+
+    sigemptyset(&urg);
+    sigaddset(&urg, SIGURG);
+    pthread_sigmask(SIG_UNBLOCK, &urg, NULL);
+
+    notif = safe_malloc(notify_sizes.seccomp_notif);
+    resp = safe_malloc(notify_sizes.seccomp_notif_resp);
+    while (!notify_done) {
+        memset(notif, 0, notify_sizes.seccomp_notif);
+        if (ioctl(notify_fd, SECCOMP_IOCTL_NOTIF_RECV, notif) < 0) {
+            // the tracee is gone, or we are woken up to exit
+            if (errno == ENOENT || errno == EINTR) {
+                continue;
+            }
+            err(1, "ioctl(NOTIF_RECV)");
+        }
+        notify_serve(req, notif, resp);
+    }
+    free(notif);
+    free(resp);
+
+    return NULL;
+}
+
+/* start the workers, the main thread goes on with the ptrace engine */
+void sbox_notify_start(void)
+{
+    struct sigaction sa = {
+        .sa_handler = notify_wakeup, /* no SA_RESTART */
+    };
+    sigset_t all, old;
+    int i;
+
+    if (syscall(SYS_seccomp, SECCOMP_GET_NOTIF_SIZES, 0, &notify_sizes) < 0) {
+        err(1, "seccomp(GET_NOTIF_SIZES)");
+    }
+    if (notify_sizes.seccomp_notif < sizeof(struct seccomp_notif)) {
+        notify_sizes.seccomp_notif = sizeof(struct seccomp_notif);
+    }
+    if (notify_sizes.seccomp_notif_resp < sizeof(struct seccomp_notif_resp)) {
+        notify_sizes.seccomp_notif_resp = sizeof(struct seccomp_notif_resp);
+    }
+    notify_reqs = safe_malloc(sizeof(*notify_reqs) * opt_notify_threads);
+    notify_workers = safe_malloc(sizeof(*notify_workers) * opt_notify_threads);
+
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGURG, &sa, NULL);
+
+    // workers leave the other signals to the main thread
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+    for (i = 0; i < opt_notify_threads; i ++) {
+        if (pthread_create(&notify_workers[i], NULL, notify_worker,
+                           &notify_reqs[i])) {
+            errx(1, "failed to create a supervisor thread");
+        }
+    }
+    // an external SIGURG then goes to a worker, which ignores it
+    sigaddset(&old, SIGURG);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    dbg(notify, "%d supervisor threads", opt_notify_threads);
+}
+
+/* no tracee is left on our filter, wait for the workers to return */
+void sbox_notify_stop(void)
+{
+    int i;
+
+    if (!notify_workers) {
+        return;
+    }
+
+    notify_done = 1;
+    for (i = 0; i < opt_notify_threads; i ++) {
+        // a worker can be between the check and the ioctl when the
+        // signal lands, so keep kicking until it is gone
+        while (pthread_tryjoin_np(notify_workers[i], NULL) == EBUSY) {
+            pthread_kill(notify_workers[i], SIGURG);
+            usleep(1000);
+        }
+    }
+
+    free(notify_workers);
+    free(notify_reqs);
+    notify_workers = NULL;
+    close(notify_fd);
+}
+
+#else /* !SECCOMP_IOCTL_NOTIF_ADDFD */
+
+void sbox_notify_prepare(void)
+{
+    errx(1, "seccomp user notification is not supported");
+}
+
+void sbox_notify_install(void) {}
+void sbox_notify_attach(int pid) {}
+void sbox_notify_start(void) {}
+void sbox_notify_stop(void) {}
+void sbox_notify_hijack_str(struct tcb *tcp, int arg, char *new, int len) {}
+
+#endif
@@ -0,0 +1,11 @@
+#pragma once
+
+//
+// seccomp user notification engine (-u), see notify.c
+//
+extern void sbox_notify_prepare(void);
+extern void sbox_notify_install(void);
+extern void sbox_notify_attach(int pid);
+extern void sbox_notify_start(void);
+extern void sbox_notify_stop(void);
+extern void sbox_notify_hijack_str(struct tcb *tcp, int arg, char *new, int len);
@@ -2,12 +2,19 @@
 #include "sbox.h"
 #include "dbg.h"
 #include "fsmap.h"
+#include "fsindex.h"
 #include "md5map.h"
+#include "nameset.h"
+#include "journal.h"
+#include "notify.h"
 
 #include <err.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <ftw.h>
 #include <assert.h>
+#include <pthread.h>
+#include <utime.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <sys/uio.h>
@@ -17,9 +24,16 @@
 #include <sys/syscall.h>
 #include <sys/socket.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <linux/filter.h>
 #include <linux/seccomp.h>
+#include <linux/kcmp.h>
+
+#ifndef __NR_mseal
+# define __NR_mseal 462
+#endif
 
 struct linux_dirent {
     long           d_ino;
@@ -28,50 +42,238 @@ struct linux_dirent {
     char           d_name[];
 };
 
+struct linux_dirent64 {
+    uint64_t       d_ino;
+    int64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+//
+// a dir listed in the sandboxfs, to be followed by the same dir in the
+// hostfs once read to its end (see. sbox_getdents()): hostfs entries
+// are streamed from host, but for the names in the sandboxfs dir (read
+// at once) and those deleted. the hostfs records returned are given
+// d_off of our own, SBOX_DENTS_OFF + their number, which sbox_lseek()
+// takes back to where they are in host.
+//
+#define DENTS_BUF_MAX (1 << 20)    /* of a getdents() merged */
+
+struct sbox_dents {
+    int host;                      /* the dir in the hostfs */
+    struct nameset names;          /* in the dir in the sandboxfs */
+    long long end;                 /* of the sandboxfs dir, its fd stays */
+    int nr;                        /* hostfs records returned, -1: rewound */
+    int nums;                      /* d_off given, so far */
+    int max;                       /* of offs */
+    off_t *offs;                   /* in host, after each one numbered */
+    int size;                      /* of buf */
+    char *buf;
+    int len;                       /* of the hpn */
+    char hpn[PATH_MAX];            /* of the dir, then of an entry */
+};
+
 #define min(a, b) ((a) < (b)? (a): (b))
 
-/* os global structure */
+/* os global structure, shared by supervisor threads (-u -j) */
 static struct fsmap* os_deleted_fs = NULL; /* deleted fs map */
-static struct md5map* os_md5map    = NULL; /* keep md5sums of original files */
+static struct md5map os_md5map;             /* keep digests of original files */
+static struct fsindex* os_sboxfs   = NULL; /* what may exist in the sandboxfs */
+static struct nameset os_changes;           /* hpns written to the sandboxfs */
+static struct journal os_journal;           /* changes to the maps above */
+
+static pthread_rwlock_t os_deleted_fs_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_rwlock_t os_sboxfs_lock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t os_copyup_lock = PTHREAD_MUTEX_INITIALIZER; /* and md5map, os_copyup */
+static pthread_mutex_t os_changes_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// records of the journal (and the snapshot), each appended under the
+// lock of the map it changes. a snapshot takes all the map locks, in
+// this order: os_deleted_fs, os_copyup (md5map) and os_changes.
+//
+#define META_DELETED  'D'          /* val: PATH_DELETED or PATH_ALLOWED */
+#define META_PRUNED   'P'          /* a dir deleted, with all below it */
+#define META_DIGEST   'M'          /* val: the digest of the original */
+#define META_CHANGED  'C'          /* written to the sandboxfs, no val */
+
+#define META_VERSION_CHANGES 4     /* the first with META_CHANGED */
+
+#define META_COMPACT  (1 << 20)    /* journal bytes, before a snapshot */
+
+/* meta file I/O in this run, appends are timed by os_journal */
+static struct {
+    long long records;             /* loaded */
+    long long usec_load;
+    int snapshots;
+    long long usec_snapshot;
+    int seed;                      /* no META_CHANGED loaded: 1, and
+                                      then 1 + the files seeded */
+} os_meta;
+
+static void sbox_check_meta(void);
+static void sbox_snapshot_meta(int force, int report);
+
+/* files copied up to the sandboxfs in this run */
+static struct {
+    int files;
+    int shared;                    /* of them, from the store (-K) */
+    long long bytes;
+    long long usec;
+} os_copyup;
+
+/* <opt_store>/<digest>: the store of copied-up files shared by the
+   sandboxes, "" if not used (see. sbox_copyup_shared()) */
+static char os_store[PATH_MAX];
+static pthread_mutex_t os_systemlog_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* bumped when a file or directory is renamed, or a directory removed:
+   the cached paths of cwds and fds may be stale (struct sbox_fs/files) */
+static unsigned int os_dirs_gen = 0;
+static int os_no_kcmp = 0;               /* kcmp() is not supported */
+static int os_seal = 0;                  /* mseal() of the scratch works */
+static struct sbox_files *os_files = NULL; /* fd tables of the tracees */
+static int os_fd_copies = 0;             /* of their fds, kept open */
+static int os_fd_copies_max = SBOX_FD_COPIES;
+static volatile int os_stop_pid = 0;     /* a notification worker stopped it */
 
 int sbox_is_deleted(char *path)
 {
-    return is_deleted(os_deleted_fs, path);
+    int deleted;
+
+    pthread_rwlock_rdlock(&os_deleted_fs_lock);
+    deleted = is_deleted(os_deleted_fs, path);
+    pthread_rwlock_unlock(&os_deleted_fs_lock);
+
+    return deleted;
+}
+
+/* spn may come to exist (and anything below it, if INDEX_OPAQUE) */
+static
+void sbox_index_spn(char *spn, int flags)
+{
+    if (!is_in_sboxfs(spn)) {
+        return;
+    }
+    pthread_rwlock_wrlock(&os_sboxfs_lock);
+    add_path_to_fsindex(os_sboxfs, spn + opt_root_len, flags);
+    pthread_rwlock_unlock(&os_sboxfs_lock);
 }
 
-static inline
-int __sbox_delete_file(char *path)
+/* path_exists(spn), without access() for what is not in the sandboxfs */
+static
+int sbox_spn_exists(char *spn)
 {
-    add_path_to_fsmap(&os_deleted_fs, path, PATH_DELETED);
-    return 1;
+    int may_exist;
+
+    pthread_rwlock_rdlock(&os_sboxfs_lock);
+    may_exist = may_exist_in_fsindex(os_sboxfs, spn + opt_root_len);
+    pthread_rwlock_unlock(&os_sboxfs_lock);
+
+    return may_exist && path_exists(spn);
 }
 
 static
-int __sbox_delete_dir(char *path)
+int _sbox_index_entry(const char *path, const struct stat *sb, int type, struct FTW *ftw)
 {
-    const int path_len = strlen(path);
-    struct fsmap *s;
-    struct fsmap *tmp;
+    // symlinks lead anywhere, and unreadable dirs hide their contents
+    int flags = (type == FTW_SL || type == FTW_DNR) ? INDEX_OPAQUE : 0;
+
+    if (ftw->level > 0) {
+        add_path_to_fsindex(os_sboxfs, path + opt_root_len, flags);
+    }
 
-    HASH_ITER(hh, os_deleted_fs, s, tmp) {
-        if (strncmp(s->key, path, path_len) == 0) {
-            dbg(fsmap, "merging deleted file: %s", s->key);
-            HASH_DEL(os_deleted_fs, s);
-            free(s);
+    // files of a sandbox older than the change log
+    if (os_meta.seed && ftw->level > 0 && type != FTW_D && type != FTW_DNR) {
+        const char *hpn = path + opt_root_len;
+        if (!has_name_in_set(&os_changes, hpn, strlen(hpn))) {
+            add_name_to_set(&os_changes, hpn, strlen(hpn));
+            os_meta.seed ++;
         }
     }
+    return 0;
+}
+
+//
+// index what the sandboxfs already has, from earlier runs; the change
+// log of a sandbox without one (see. sbox_log_change()) is seeded on
+// the way, and kept from now on
+//
+static
+void sbox_load_sboxfs(void)
+{
+    os_sboxfs = alloc_fsindex();
+    if (nftw(opt_root, _sbox_index_entry, 64, FTW_PHYS) < 0 && errno != ENOENT) {
+        // can't tell what is there, so index anything
+        add_path_to_fsindex(os_sboxfs, "/", INDEX_OPAQUE);
+    }
+    if (os_meta.seed > 1) {
+        sbox_snapshot_meta(1, 0);
+    }
+    os_meta.seed = 0;
+}
+
+//
+// hpn is (or is about to be) written to the sandboxfs: the change log
+// lists, diffs and commits these (see. sbox_list_changes()), along
+// with the deleted files, instead of walking the sandboxfs, mostly
+// parent dirs synced from the hostfs. hpn may not come to exist (e.g.,
+// a failed open()), so is checked then.
+//
+static
+void sbox_log_change(char *hpn)
+{
+    size_t len = strlen(hpn);
+
+    pthread_mutex_lock(&os_changes_lock);
+    if (!has_name_in_set(&os_changes, hpn, len)) {
+        add_name_to_set(&os_changes, hpn, len);
+        journal_append(&os_journal, META_CHANGED, hpn, "", 0);
+        pthread_mutex_unlock(&os_changes_lock);
+        sbox_check_meta();
+        return;
+    }
+    pthread_mutex_unlock(&os_changes_lock);
+}
+
+static
+void __sbox_mark_path(int type, char *path, int val)
+{
+    pthread_rwlock_wrlock(&os_deleted_fs_lock);
+    if (type == META_PRUNED) {
+        prune_fsmap(os_deleted_fs, path);
+    }
+    add_path_to_fsmap(os_deleted_fs, path, val);
+    journal_append(&os_journal, type, path, &val, sizeof(val));
+    pthread_rwlock_unlock(&os_deleted_fs_lock);
+
+    sbox_check_meta();
+}
 
-    add_path_to_fsmap(&os_deleted_fs, path, PATH_DELETED);
+static inline
+int __sbox_delete_file(char *path)
+{
+    __sbox_mark_path(META_DELETED, path, PATH_DELETED);
+    return 1;
+}
+
+static
+int __sbox_delete_dir(char *path)
+{
+    __sbox_mark_path(META_PRUNED, path, PATH_DELETED);
     return 1;
 }
 
 static
 int __sbox_allow_path(char *path)
 {
-    add_path_to_fsmap(&os_deleted_fs, path, PATH_ALLOWED);
+    __sbox_mark_path(META_DELETED, path, PATH_ALLOWED);
     return 1;
 }
 
+#define META_VERSION 2             /* of the text .meta, before journal.h */
+
 static
 char *__sbox_meta_file(void)
 {
@@ -83,83 +285,250 @@ char *__sbox_meta_file(void)
     return path;
 }
 
+static
+char *__sbox_journal_file(void)
+{
+    static char *path = NULL;
+    if (!path) {
+        path = (char *)safe_malloc(PATH_MAX);
+        snprintf(path, PATH_MAX, "%s.journal", opt_root);
+    }
+    return path;
+}
+
+/* what is written to a snapshot, or listed at exit */
+struct meta_flush {
+    struct journal_writer *w;      /* NULL if only listed */
+    int report;
+};
 
 static
-void _sbox_flush_deleted_files(void)
+void _sbox_flush_deleted_file(const char *path, int val, void *arg)
 {
-    // only if we have something to flush
-    if (!os_deleted_fs) {
-        return;
+    struct meta_flush *f = arg;
+
+    if (f->report) {
+        fprintf(stderr, " > %s (%x)\n", path, val);
     }
+    if (f->w) {
+        journal_put(f->w, META_DELETED, path, &val, sizeof(val));
+    }
+}
 
-    FILE *fp = fopen(__sbox_meta_file(), "w+");
-    if (!fp) {
-        err(1, "fopen");
+static
+void _sbox_flush_deleted_files(struct meta_flush *f)
+{
+    if (is_empty_fsmap(os_deleted_fs)) {
+        return;
     }
 
-    struct fsmap *s;
-    struct fsmap *tmp;
+    if (f->report) {
+        fprintf(stderr, "Deleted Files:\n");
+    }
+    walk_fsmap(os_deleted_fs, _sbox_flush_deleted_file, f);
+}
 
-    fprintf(stderr, "Deleted Files:\n");
-    HASH_ITER(hh, os_deleted_fs, s, tmp) {
-        fprintf(stderr, " > %s (%x)\n", s->key, s->val);
-        fprintf(fp, "D:%s:%d\n", s->key, s->val);
+static
+void _sbox_flush_md5sums(struct meta_flush *f)
+{
+    if (!os_md5map.entries) {
+        return;
     }
 
-    fclose(fp);
+    struct md5entry *s;
+    struct md5entry *tmp;
+
+    // kept from earlier runs even without -m, but only listed with it
+    int report = f->report && opt_md5;
+    if (report) {
+        fprintf(stderr, "Digests (%s) of original files:\n", os_md5map.alg->name);
+    }
+    HASH_ITER(hh, os_md5map.entries, s, tmp) {
+        if (report) {
+            int i;
+            char hex[DIGEST_MAX_LEN*2+1];
+            for (i = 0; i < os_md5map.alg->len; i ++) {
+                snprintf(hex+i*2, 3, "%02x", (unsigned int)s->val[i]);
+            }
+            fprintf(stderr, " > %s (%s)\n", s->key, hex);
+        }
+        if (f->w) {
+            journal_put(f->w, META_DIGEST, s->key, s->val, os_md5map.alg->len);
+        }
+    }
 }
 
 static
-void _sbox_flush_md5sums(void)
+void _sbox_flush_changes(struct meta_flush *f)
 {
-    // only if we have something to flush
-    if (!os_md5map || !opt_md5) {
+    struct nameentry *s;
+    struct nameentry *tmp;
+
+    // listed by sbox_interactive(), not at exit
+    if (!f->w) {
         return;
     }
-
-    FILE *fp = fopen(__sbox_meta_file(), "a+");
-    if (!fp) {
-        err(1, "fopen");
+    HASH_ITER(hh, os_changes.entries, s, tmp) {
+        journal_put(f->w, META_CHANGED, s->name, "", 0);
     }
+}
 
-    struct md5map *s;
-    struct md5map *tmp;
+/* the journal size past which a snapshot is due: it outgrew the last one */
+static
+off_t sbox_meta_due(off_t snapshot)
+{
+    return snapshot > META_COMPACT ? snapshot : META_COMPACT;
+}
 
-    fprintf(stderr, "MD5 Sums of original files:\n");
-    HASH_ITER(hh, os_md5map, s, tmp) {
-        int i;
-        char md5str[MD5_DIGEST_LENGTH*2+1];
-        for (i = 0; i < MD5_DIGEST_LENGTH; i ++) {
-            snprintf(md5str+i*2, 3, "%02x", (unsigned int)s->val[i]);
+//
+// write the maps to a new snapshot, and empty the journal (see.
+// journal.h): periodically if force is 0, once the journal is due
+// (checked again, another thread may just have done it)
+//
+static
+void sbox_snapshot_meta(int force, int report)
+{
+    struct journal_writer w;
+    struct meta_flush f = { &w, report };
+    struct timespec beg, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &beg);
+    pthread_rwlock_rdlock(&os_deleted_fs_lock);
+    pthread_mutex_lock(&os_copyup_lock);
+    pthread_mutex_lock(&os_changes_lock);
+
+    if ((force || journal_due(&os_journal))
+        && journal_create(&w, __sbox_meta_file(), os_md5map.alg->name)) {
+        _sbox_flush_deleted_files(&f);
+        _sbox_flush_md5sums(&f);
+        _sbox_flush_changes(&f);
+        if (journal_commit(&w)) {
+            journal_reset(&os_journal, sbox_meta_due(w.size));
         }
-
-        fprintf(stderr, " > %s (%s)\n", s->key, md5str);
-        fprintf(fp, "M:%s:%s\n", s->key, md5str);
+        os_meta.snapshots ++;
     }
 
-    fclose(fp);
+    pthread_mutex_unlock(&os_changes_lock);
+    pthread_mutex_unlock(&os_copyup_lock);
+    pthread_rwlock_unlock(&os_deleted_fs_lock);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    os_meta.usec_snapshot += (end.tv_sec - beg.tv_sec) * 1000000LL
+        + (end.tv_nsec - beg.tv_nsec) / 1000;
+}
+
+/* after a record was appended, with none of the map locks held */
+static
+void sbox_check_meta(void)
+{
+    if (journal_due(&os_journal)) {
+        sbox_snapshot_meta(0, 0);
+    }
 }
 
+//
+// at exit: a snapshot of what the journal has since the last one, so
+// the next run loads one file (or nothing, if nothing changed), and a
+// list of the maps
+//
 void sbox_flush_meta(void)
 {
-    _sbox_flush_deleted_files();
-    _sbox_flush_md5sums();
+    struct meta_flush f = { NULL, 1 };
+
+    if (!journal_empty(&os_journal)) {
+        sbox_snapshot_meta(1, 1);
+        return;
+    }
+
+    pthread_rwlock_rdlock(&os_deleted_fs_lock);
+    pthread_mutex_lock(&os_copyup_lock);
+    _sbox_flush_deleted_files(&f);
+    _sbox_flush_md5sums(&f);
+    pthread_mutex_unlock(&os_copyup_lock);
+    pthread_rwlock_unlock(&os_deleted_fs_lock);
 }
 
-void sbox_load_meta(void)
+/* the digest of a file loaded, which the sandbox keeps */
+static
+const struct digest *sbox_meta_digest(const char *name)
+{
+    const struct digest *alg = find_digest(name);
+
+    if (!alg) {
+        errx(1, "Unknown digest in %s: %s", __sbox_meta_file(), name);
+    }
+    if (alg != os_md5map.alg) {
+        if (opt_digest) {
+            warnx("%s has %s digests, keeping them", __sbox_meta_file(),
+                  alg->name);
+        }
+        os_md5map.alg = alg;
+    }
+    return alg;
+}
+
+static
+void _sbox_load_record(int type, const char *key, const void *val,
+                       int vallen, void *arg)
+{
+    struct journal_hdr *hdr = arg;
+
+    switch (type) {
+    case META_DELETED:
+    case META_PRUNED: {
+        int flag;
+        if (vallen != sizeof(flag)) {
+            errx(1, "Malformed %s file", __sbox_meta_file());
+        }
+        memcpy(&flag, val, sizeof(flag));
+        if (type == META_PRUNED) {
+            prune_fsmap(os_deleted_fs, key);
+        }
+        add_path_to_fsmap(os_deleted_fs, key, flag);
+        break;
+    }
+    case META_DIGEST: {
+        const struct digest *alg = sbox_meta_digest(hdr->alg);
+        struct md5entry *s;
+        if (vallen != alg->len) {
+            errx(1, "Malformed %s file", __sbox_meta_file());
+        }
+        // the journal may repeat what the snapshot has
+        s = get_md5_from_map(&os_md5map, (char *)key);
+        if (s) {
+            memcpy(s->val, val, vallen);
+        } else {
+            add_md5_to_map(&os_md5map, (char *)key, (byte *)val);
+        }
+        break;
+    }
+    case META_CHANGED:
+        if (!has_name_in_set(&os_changes, key, strlen(key))) {
+            add_name_to_set(&os_changes, key, strlen(key));
+        }
+        break;
+    default:
+        errx(1, "Unknown meta data in %s: %c", __sbox_meta_file(), type);
+    }
+}
+
+static
+void sbox_load_text_meta(void)
 {
     FILE *fp = fopen(__sbox_meta_file() , "r");
     if (!fp) {
-        /* okay */
-        return;
+        err(1, "fopen %s", __sbox_meta_file());
     }
 
+    // until told otherwise (version 1)
+    const struct digest *alg = find_digest("md5");
+
     size_t len = 0;
     char *line = NULL;
     while (getline(&line, &len, fp) != -1) {
         if (len < 2 || line[1] != ':') {
             errx(1, "Malformed %s file", __sbox_meta_file());
         }
+        os_meta.records ++;
 
         char *key = line+2;
         char *val = strstr(key, ":");
@@ -171,21 +540,42 @@ void sbox_load_meta(void)
         val ++;
 
         switch (line[0]) {
+        case 'V': {
+            val[strcspn(val, "\n")] = '\0';
+            if (atoi(key) > META_VERSION) {
+                errx(1, "Unknown version of %s: %s", __sbox_meta_file(), key);
+            }
+            if (!(alg = find_digest(val))) {
+                errx(1, "Unknown digest in %s: %s", __sbox_meta_file(), val);
+            }
+            break;
+        }
         case 'D': {
             int flag;
             sscanf(val, "%d", &flag);
-            add_path_to_fsmap(&os_deleted_fs, key, flag);
+            add_path_to_fsmap(os_deleted_fs, key, flag);
             break;
         }
         case 'M': {
             int i;
-            byte md5sum[MD5_DIGEST_LENGTH];
-            for (i = 0; i < MD5_DIGEST_LENGTH; i ++) {
+            byte digest[DIGEST_MAX_LEN];
+            if (!alg || strspn(val, "0123456789abcdef") != (size_t)alg->len * 2) {
+                errx(1, "Malformed %s file", __sbox_meta_file());
+            }
+            // the sandbox keeps the digest it started with
+            if (alg != os_md5map.alg) {
+                if (opt_digest) {
+                    warnx("%s has %s digests, keeping them", __sbox_meta_file(),
+                          alg->name);
+                }
+                os_md5map.alg = alg;
+            }
+            for (i = 0; i < alg->len; i ++) {
                 unsigned int hex;
                 sscanf(val+i*2, "%02x", &hex);
-                md5sum[i] = (unsigned int) hex;
+                digest[i] = (unsigned int) hex;
             }
-            add_md5_to_map(&os_md5map, key, md5sum);
+            add_md5_to_map(&os_md5map, key, digest);
             break;
         }
         default:
@@ -196,9 +586,122 @@ void sbox_load_meta(void)
     fclose(fp);
 }
 
+
+//
+// the snapshot, and then the journal on top of it: both are replayed
+// right from their mapping. a text .meta (of version 1 or 2) is read
+// as before, and replaced by a snapshot; so is a journal left behind,
+// e.g., by a crash.
+//
+void sbox_load_meta(void)
+{
+    struct journal_hdr hdr;
+    struct timespec beg, end;
+    off_t valid;
+    off_t size = 0;
+    int snapshot = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &beg);
+
+    os_meta.seed = 1;
+    valid = journal_replay(__sbox_meta_file(), &hdr, &os_meta.records,
+                           _sbox_load_record, &hdr);
+    if (valid < 0) {
+        sbox_load_text_meta();
+        snapshot = 1;
+    } else if (valid > 0) {
+        sbox_meta_digest(hdr.alg);
+        size = valid;
+        if (hdr.version >= META_VERSION_CHANGES) {
+            os_meta.seed = 0;
+        }
+    }
+
+    valid = journal_replay(__sbox_journal_file(), &hdr, &os_meta.records,
+                           _sbox_load_record, &hdr);
+    if (valid < 0) {
+        // torn in its header, as it was created
+        warnx("%s is not a journal, ignored", __sbox_journal_file());
+        valid = 0;
+    }
+    if (valid > (off_t)sizeof(hdr)) {
+        sbox_meta_digest(hdr.alg);
+        snapshot = 1;
+    }
+    if (valid > 0 && hdr.version >= META_VERSION_CHANGES) {
+        os_meta.seed = 0;
+    }
+    journal_init(&os_journal, __sbox_journal_file(), os_md5map.alg->name,
+                 valid, sbox_meta_due(size));
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    os_meta.usec_load = (end.tv_sec - beg.tv_sec) * 1000000LL
+        + (end.tv_nsec - beg.tv_nsec) / 1000;
+
+    if (snapshot) {
+        sbox_snapshot_meta(1, 0);
+    }
+}
+
+/* seal a page of our own, which stays mapped, to see if mseal() works */
+static
+int sbox_probe_seal(void)
+{
+    void *page = mmap(NULL, 4096, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (page == MAP_FAILED) {
+        return 0;
+    }
+    if (syscall(__NR_mseal, page, 4096, 0) < 0) {
+        munmap(page, 4096);
+        return 0;
+    }
+    return 1;
+}
+
+//
+// a sealed scratch can't be unmapped, remapped or made writable, so
+// these don't have to be stopped at (see. _check_memory_region())
+//
+void sbox_relax_filter(struct sock_filter *filter, int len)
+{
+    int i, nr = -1;
+
+    if (!os_seal) {
+        return;
+    }
+    for (i = 0; i < len; i ++) {
+        if (filter[i].code == (BPF_JMP+BPF_JEQ+BPF_K)) {
+            nr = filter[i].k;
+        }
+        if (filter[i].code == (BPF_RET+BPF_K)
+            && filter[i].k == SECCOMP_RET_TRACE
+            && (nr == __NR_mmap || nr == __NR_mprotect
+                || nr == __NR_mremap || nr == __NR_munmap)) {
+            filter[i].k = SECCOMP_RET_ALLOW;
+        }
+    }
+}
+
 void sbox_init(void)
 {
+    os_md5map.alg = find_digest(opt_digest ? opt_digest : DIGEST_DEFAULT);
+    if (!os_md5map.alg) {
+        errx(1, "Unknown digest: %s", opt_digest);
+    }
+    os_seal = sbox_probe_seal();
+    os_deleted_fs = alloc_fsmap();
     sbox_load_meta();
+    sbox_load_sboxfs();
+
+    // keyed by the digest the sandbox keeps (sbox_load_meta())
+    if (opt_store) {
+        snprintf(os_store, sizeof(os_store), "%s/%s",
+                 opt_store, os_md5map.alg->name);
+        if (!mkdirp(os_store, 0755)) {
+            err(1, "Failed to create the store %s", os_store);
+        }
+    }
 }
 
 void sbox_cleanup(void)
@@ -216,10 +719,31 @@ void sbox_cleanup(void)
         }
     }
 
+    if (os_copyup.files) {
+        fprintf(stderr, "Copy-up: %d files (%d from the store), "
+                "%lld bytes in %.3f sec\n", os_copyup.files, os_copyup.shared,
+                os_copyup.bytes, os_copyup.usec / 1e6);
+    }
+
     // dump into a permanent place
     sbox_flush_meta();
 
-    // NOTE. we are going to die anyway.
+    if (os_meta.records || os_journal.records || os_meta.snapshots) {
+        fprintf(stderr, "Meta: %lld records loaded in %.3f sec, %lld appended "
+                "in %.3f sec, %d snapshots in %.3f sec\n", os_meta.records,
+                os_meta.usec_load / 1e6, os_journal.records,
+                os_journal.usec / 1e6, os_meta.snapshots,
+                os_meta.usec_snapshot / 1e6);
+    }
+
+    if (os_copyup.files || !is_empty_fsmap(os_deleted_fs)) {
+        fprintf(stderr, "Maps: deleted %zu bytes, digests %zu bytes, "
+                "sboxfs %zu bytes\n", fsmap_bytes(os_deleted_fs),
+                md5map_bytes(&os_md5map), fsindex_bytes(os_sboxfs));
+    }
+
+    // NOTE. we are going to die anyway (and sbox_interactive() still
+    // needs the maps); free_*() would release their arenas in bulk.
     // free_fsmap(os_deleted_fs);
     // free_systemlog(systemlog);
 }
@@ -289,124 +813,610 @@ void sbox_check_test_cond(const char *pn, const char *key)
     fclose(fp);
 }
 
+#ifndef __NR_pidfd_open
+# define __NR_pidfd_open  434
+#endif
+#ifndef __NR_pidfd_getfd
+# define __NR_pidfd_getfd 438
+#endif
+
+//
+// a copy of an fd of the tracee (pidfd_getfd), sharing its open file
+// and so its offset: the very file the tracee has, not one reopened
+// by its path, which may have been renamed since. the pidfd is kept
+// along the tcb. -1 if the kernel can't (< 5.6).
+//
 static
-int get_fd_path(int pid, int fd, char *path, int len)
+int sbox_getfd(struct tcb *tcp, int fd)
 {
-    ssize_t read;
-    char proc[PATH_MAX];
+    static int no_pidfd = 0;
+    int copy;
 
-    snprintf(proc, sizeof(proc), "/proc/%d/fd/%d", pid, fd);
-    if ((read = readlink(proc, path, len - 1)) < 0) {
-        /* fd doesn't exist*/
-        path[0] = '\0';
-        return 0;
+    if (no_pidfd) {
+        return -1;
     }
-    path[read] = '\0';
-    dbg(test, "> %s", path);
-
-    return 1;
+    if (tcp->pidfd < 0) {
+        tcp->pidfd = syscall(__NR_pidfd_open, tcp->pid, 0);
+        if (tcp->pidfd < 0) {
+            no_pidfd = errno == ENOSYS;
+            return -1;
+        }
+    }
+    copy = syscall(__NR_pidfd_getfd, tcp->pidfd, fd, 0);
+    if (copy < 0 && errno == ENOSYS) {
+        no_pidfd = 1;
+    }
+    return copy;
 }
 
-static
-int get_fd_hpn(int pid, int fd, char *path, int len)
+void sbox_put_pidfd(struct tcb *tcp)
 {
-    int fd_in_sbox = 0;
-
-    // XXX. ugly
-    if (!get_fd_path(pid, fd, path, len)) {
-        return 0;
+    if (tcp->pidfd >= 0) {
+        close(tcp->pidfd);
     }
+    tcp->pidfd = -1;
+}
 
-    // check if cwd is under sboxfs
-    if (is_in_sboxfs(path)) {
-        char *iter;
-        for (iter = path; *(iter + opt_root_len) != '\0'; iter ++) {
-            *iter = *(iter + opt_root_len);
-        }
-        *iter = '\0';
-        fd_in_sbox = 1;
+static
+void sbox_free_dents(struct sbox_dents *dents)
+{
+    if (dents) {
+        close(dents->host);
+        free_nameset(&dents->names);
+        free(dents->offs);
+        free(dents->buf);
+        free(dents);
     }
-
-    return fd_in_sbox;
 }
 
-static
-int get_cwd_hpn(int pid, char *path, int len)
+/* a new process image, its fds are read from /proc when first needed */
+struct sbox_files *sbox_new_files(void)
 {
-    int cwd_in_sbox = 0;
-    ssize_t read;
-    char proc[PATH_MAX];
+    struct sbox_files *files = safe_malloc(sizeof(*files));
 
-    snprintf(proc, sizeof(proc), "/proc/%d/cwd", pid);
-    if ((read = readlink(proc, path, len - 1)) < 0) {
-        err(1, "proc/cwd");
+    files->refcnt = 1;
+    files->used = 0;
+    files->pid = 0;
+    files->nfds = 0;
+    files->fds = NULL;
+    files->prev = NULL;
+    files->next = os_files;
+    if (os_files) {
+        os_files->prev = files;
     }
-    path[read] = '\0';
+    os_files = files;
+    return files;
+}
 
-    // check if cwd is under sboxfs
-    if (is_in_sboxfs(path)) {
-        char *iter;
-        for (iter = path; *(iter + opt_root_len) != '\0'; iter ++) {
-            *iter = *(iter + opt_root_len);
-        }
-        *iter = '\0';
-        dbg(test, "cwd in sboxfs: %s", path);
-        cwd_in_sbox = 1;
+static
+void sbox_close_copy(struct sbox_fdent *ent)
+{
+    if (ent->copy >= 0) {
+        close(ent->copy);
+        os_fd_copies --;
     }
+    ent->copy = -1;
+}
 
-    return cwd_in_sbox;
+static
+void sbox_clear_fdent(struct sbox_fdent *ent)
+{
+    free(ent->path);
+    ent->path = NULL;
+    sbox_free_dents(ent->dents);
+    ent->dents = NULL;
+    sbox_close_copy(ent);
 }
 
 //
-// get a path relative to fd from a syscall
-// return 1 if cwd is on the sboxfs
+// too many copies are open: drop the ones of the fds closed since
+// (close() isn't stopped at under -s), then if that's not enough, all
+// but the ones of merged listings under way. what is dropped is read
+// from /proc again once used.
 //
 static
-int get_hpn_from_fd_and_arg(struct tcb *tcp, int fd, int arg, char *path, int len)
+void sbox_shrink_fds(void)
 {
-    // ugly realpath requirement
-    assert(len == PATH_MAX);
+    static pid_t self = 0;
+    struct sbox_files *files;
+    int fd, all;
 
-    char pn[PATH_MAX];
-    const long ptr = tcp->u_arg[arg];
-    // fprintf(stderr, "XXX: read %x (pid=%d)\n", ptr, tcp->pid);
-    if (ptr == 0 || umovestr(tcp, ptr, PATH_MAX, pn) <= 0) {
-        pn[0] = '\0';
-        return -1;
-    }
-    if (pn[0] == '\0') {
-        return -1;
+    if (!self) {
+        self = getpid();
     }
-    // fprintf(stderr, "XXX: %s\n", pn);
+    for (all = 0; all < 2 && os_fd_copies >= os_fd_copies_max / 2; all ++) {
+        for (files = os_files; files; files = files->next) {
+            for (fd = 0; fd < files->nfds; fd ++) {
+                struct sbox_fdent *ent = &files->fds[fd];
+                if (ent->copy < 0) {
+                    continue;
+                }
+                if (all ? !ent->dents
+                        : syscall(SYS_kcmp, self, files->pid, KCMP_FILE,
+                                  ent->copy, fd) != 0) {
+                    sbox_clear_fdent(ent);
+                }
+            }
+        }
+    }
+    dbg(info, "fd copies shrunk to %d", os_fd_copies);
+}
+
+//
+// the mirrors keep a copy of each dir fd of the tracees: raise our
+// soft limit to the hard one, after the child is started with the
+// limit it had, and keep a half for the rest (copy-ups, pidfds, ...)
+//
+void sbox_raise_nofile(void)
+{
+    struct rlimit rl;
+
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) {
+        return;
+    }
+    if (rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        if (setrlimit(RLIMIT_NOFILE, &rl) < 0) {
+            getrlimit(RLIMIT_NOFILE, &rl);
+        }
+    }
+    os_fd_copies_max = rl.rlim_cur / 2 < SBOX_FD_COPIES
+        ? rl.rlim_cur / 2 : SBOX_FD_COPIES;
+}
+
+void sbox_put_files(struct tcb *tcp)
+{
+    struct sbox_files *files = tcp->files;
+    int fd;
+
+    tcp->files = NULL;
+    if (!files || --files->refcnt > 0) {
+        return;
+    }
+    for (fd = 0; fd < files->nfds; fd ++) {
+        sbox_clear_fdent(&files->fds[fd]);
+    }
+    if (files->prev) {
+        files->prev->next = files->next;
+    } else {
+        os_files = files->next;
+    }
+    if (files->next) {
+        files->next->prev = files->prev;
+    }
+    free(files->fds);
+    free(files);
+}
+
+/* a private copy of the fds, as fork() or unshare(CLONE_FILES) makes */
+static
+struct sbox_files *sbox_copy_files(struct sbox_files *files)
+{
+    struct sbox_files *copy = sbox_new_files();
+    int fd;
+
+    copy->used = 1;
+    copy->pid = files->pid;
+    copy->nfds = files->nfds;
+    copy->fds = safe_malloc(files->nfds * sizeof(*files->fds));
+    for (fd = 0; fd < files->nfds; fd ++) {
+        struct sbox_fdent *ent = &copy->fds[fd];
+
+        *ent = files->fds[fd];
+        ent->dents = NULL;
+        ent->copy = -1;
+        if (ent->path && os_fd_copies < os_fd_copies_max
+            && (ent->copy = dup(files->fds[fd].copy)) >= 0) {
+            ent->path = strdup(ent->path);
+            os_fd_copies ++;
+        } else {
+            ent->path = NULL;
+        }
+    }
+    return copy;
+}
+
+/* the fds of a new child: the parent's ones (CLONE_FILES), or a copy */
+void sbox_inherit_files(struct tcb *child, struct tcb *parent, int shared)
+{
+    struct sbox_files *files = parent->files;
 
-    // abspath
-    if (pn[0] == '/') {
-        strncpy(path, pn, len);
-        normalize_path(path);
+    // the child already looked up or closed its fds
+    if (!files || !child->files || child->files->used) {
+        return;
+    }
+
+    sbox_put_files(child);
+    if (shared) {
+        files->refcnt ++;
+        child->files = files;
+        return;
+    }
+    child->files = sbox_copy_files(files);
+}
+
+/* the tracee no longer shares its fds with other processes */
+static
+void sbox_unshare_files(struct tcb *tcp)
+{
+    struct sbox_files *copy;
+
+    if (!tcp->files || tcp->files->refcnt == 1) {
+        return;
+    }
+    copy = sbox_copy_files(tcp->files);
+    sbox_put_files(tcp);
+    tcp->files = copy;
+}
+
+/* the fd is closed or replaced by the tracee */
+static
+void sbox_forget_fd(struct tcb *tcp, int fd)
+{
+    struct sbox_files *files = tcp->files;
+
+    if (!files) {
+        return;
+    }
+    files->used = 1;
+    if (fd >= 0 && fd < files->nfds) {
+        sbox_clear_fdent(&files->fds[fd]);
+    }
+}
+
+//
+// is the fd still the open file we remember? close() and friends are
+// not stopped at under -s, so an fd may have been closed and its slot
+// reused since; the copy we keep along tells, by kcmp(KCMP_FILE).
+// without a copy or kcmp(), only the ptrace engine, which sees every
+// close(), can tell.
+//
+static
+int sbox_fd_valid(struct tcb *tcp, int fd)
+{
+    struct sbox_fdent *ent = &tcp->files->fds[fd];
+    static pid_t self = 0;
+    long ret = -1;
+
+    if (!self) {
+        self = getpid();
+    }
+    if (ent->copy >= 0) {
+        ret = syscall(SYS_kcmp, self, tcp->pid, KCMP_FILE, ent->copy, fd);
+        if (ret < 0 && errno == ENOSYS) {
+            os_no_kcmp = 1;
+        }
+    }
+    if (ret == 0 || (ret < 0 && errno != EBADF && !opt_seccomp)) {
+        return 1;
+    }
+    sbox_clear_fdent(ent);
+    return 0;
+}
+
+//
+// only dirs are remembered: what *at() and getdents() take. the copy
+// keeps the open file alive, which must not outlive the tracee's own
+// fd for anything else (a pipe never seeing EOF, an flock() held).
+//
+static
+void sbox_remember_fd(struct tcb *tcp, int fd, char *path, int len)
+{
+    struct sbox_files *files = tcp->files;
+    struct sbox_fdent *ent;
+    struct stat st;
+    int copy;
+
+    if (!files || fd < 0 || path[0] != '/') {
+        return;
+    }
+    if (os_fd_copies >= os_fd_copies_max) {
+        sbox_shrink_fds();
+    }
+    if ((copy = sbox_getfd(tcp, fd)) < 0 && opt_seccomp) {
+        return;
+    }
+    if (copy >= 0 && os_no_kcmp && opt_seccomp) {
+        close(copy);
+        return;
+    }
+    if (copy >= 0 && (fstat(copy, &st) < 0 || !S_ISDIR(st.st_mode))) {
+        close(copy);
+        return;
+    }
+    files->used = 1;
+    files->pid = tcp->pid;
+    if (fd >= files->nfds) {
+        int n = files->nfds ? files->nfds : 64;
+        while (n <= fd) {
+            n *= 2;
+        }
+        files->fds = realloc(files->fds, n * sizeof(*files->fds));
+        if (!files->fds) {
+            die_out_of_memory();
+        }
+        memset(files->fds + files->nfds, 0,
+               (n - files->nfds) * sizeof(*files->fds));
+        for (; files->nfds < n; files->nfds ++) {
+            files->fds[files->nfds].copy = -1;
+        }
+    }
+
+    // the same open file (see. get_fd_path()), so the listing stays
+    ent = &files->fds[fd];
+    free(ent->path);
+    sbox_close_copy(ent);
+    ent->copy = copy;
+    if (copy >= 0) {
+        os_fd_copies ++;
+    }
+    ent->path = safe_malloc(len + 1);
+    memcpy(ent->path, path, len + 1);
+    ent->len = len;
+    ent->gen = os_dirs_gen;
+}
+
+/* the path of an fd, as /proc/pid/fd/# reads, and its length (or -1) */
+static
+int get_fd_path(struct tcb *tcp, int fd, char *path, int len)
+{
+    struct sbox_files *files = tcp->files;
+    ssize_t read;
+    char proc[PATH_MAX];
+
+    if (files && fd >= 0 && fd < files->nfds
+        && files->fds[fd].path && sbox_fd_valid(tcp, fd)
+        && files->fds[fd].gen == os_dirs_gen && files->fds[fd].len < len) {
+        memcpy(path, files->fds[fd].path, files->fds[fd].len + 1);
+        return files->fds[fd].len;
+    }
+
+    snprintf(proc, sizeof(proc), "/proc/%d/fd/%d", tcp->pid, fd);
+    if ((read = readlink(proc, path, len - 1)) < 0) {
+        /* fd doesn't exist*/
+        path[0] = '\0';
+        return -1;
+    }
+    path[read] = '\0';
+    dbg(test, "> %s", path);
+
+    sbox_remember_fd(tcp, fd, path, read);
+    return read;
+}
+
+//
+// a path read from /proc into the start of p->buf: if it is under the
+// sboxfs, its hpn is already in place; if not, shift it behind opt_root.
+// return 1 if it was under the sboxfs.
+//
+static
+int put_proc_hpn(struct sbox_path *p, int len)
+{
+    if (is_in_sboxfs(p->buf)) {
+        p->len = len - opt_root_len;
+        return 1;
+    }
+    memmove(sbox_hpn(p), p->buf, len + 1);
+    p->len = len;
+    return 0;
+}
+
+static
+int get_fd_hpn(struct tcb *tcp, int fd, struct sbox_path *p)
+{
+    int len = get_fd_path(tcp, fd, p->buf, PATH_MAX);
+
+    // XXX. ugly
+    if (len < 0) {
+        sbox_hpn(p)[0] = '\0';
+        p->len = 0;
         return 0;
     }
+    return put_proc_hpn(p, len);
+}
 
-    // relpath, so resolve it
+/* a new process, its cwd is read from /proc when first needed */
+struct sbox_fs *sbox_new_fs(void)
+{
+    struct sbox_fs *fs = safe_malloc(sizeof(*fs));
+
+    fs->refcnt = 1;
+    fs->valid = 0;
+    fs->used = 0;
+    return fs;
+}
+
+void sbox_put_fs(struct tcb *tcp)
+{
+    struct sbox_fs *fs = tcp->fs;
+
+    tcp->fs = NULL;
+    if (fs && --fs->refcnt == 0) {
+        free(fs);
+    }
+}
+
+/* the cwd of a new child: the parent's one (CLONE_FS), or a copy of it */
+void sbox_inherit_fs(struct tcb *child, struct tcb *parent, int shared)
+{
+    struct sbox_fs *fs = parent->fs;
+
+    // the child already looked up or changed its cwd
+    if (!fs || !child->fs || child->fs->used) {
+        return;
+    }
+
+    sbox_put_fs(child);
+    if (shared) {
+        fs->refcnt ++;
+        child->fs = fs;
+        return;
+    }
+
+    child->fs = sbox_new_fs();
+    if (fs->valid) {
+        memcpy(child->fs, fs, offsetof(struct sbox_fs, cwd) + fs->len + 1);
+        child->fs->refcnt = 1;
+    }
+}
+
+/* a file or directory was renamed or removed, maybe a cwd or an fd */
+static
+void sbox_dirs_moved(void)
+{
+    // also by a notification worker, while the ptrace engine reads it
+    __sync_fetch_and_add(&os_dirs_gen, 1);
+}
+
+static
+int get_cwd_hpn(struct tcb *tcp, struct sbox_path *p)
+{
+    struct sbox_fs *fs = tcp->fs;
+    int cwd_in_sbox = 0;
+    ssize_t read;
+    char proc[PATH_MAX];
+
+    if (fs && fs->valid && fs->gen == os_dirs_gen) {
+        memcpy(sbox_hpn(p), fs->cwd, fs->len + 1);
+        p->len = fs->len;
+        return fs->in_sbox;
+    }
+
+    snprintf(proc, sizeof(proc), "/proc/%d/cwd", tcp->pid);
+    if ((read = readlink(proc, p->buf, PATH_MAX - 1)) < 0) {
+        err(1, "proc/cwd");
+    }
+    p->buf[read] = '\0';
+
+    // check if cwd is under sboxfs
+    cwd_in_sbox = put_proc_hpn(p, read);
+    if (cwd_in_sbox) {
+        dbg(test, "cwd in sboxfs: %s", sbox_hpn(p));
+        // relative paths of syscalls we don't interpose (e.g., bind()
+        // of an AF_UNIX socket) create entries right there
+        sbox_index_spn(sbox_spn(p), INDEX_OPAQUE);
+    }
+
+    if (fs) {
+        memcpy(fs->cwd, sbox_hpn(p), p->len + 1);
+        fs->len = p->len;
+        fs->in_sbox = cwd_in_sbox;
+        fs->gen = os_dirs_gen;
+        fs->valid = 1;
+        fs->used = 1;
+    }
+
+    return cwd_in_sbox;
+}
+
+/* after chdir()/fchdir() of the tracee */
+static
+void sbox_cwd_changed(struct tcb *tcp)
+{
+    struct sbox_path p;
+
+    if (tcp->fs) {
+        tcp->fs->valid = 0;
+        tcp->fs->used = 1;
+    }
+    // read it now, so a new cwd in the sboxfs is indexed before any
+    // syscall can create an entry relative to it
+    get_cwd_hpn(tcp, &p);
+}
+
+//
+// get a path relative to fd from a syscall, as both hpn and spn
+// return 1 if cwd is on the sboxfs, -1 if there is no path (errno is
+// ENAMETOOLONG if the path, relative to a deep dir, is too long)
+//
+static
+int get_path_from_fd_and_arg(struct tcb *tcp, int fd, int arg, struct sbox_path *p)
+{
+    char *hpn = sbox_hpn(p);
+    const long ptr = tcp->u_arg[arg];
     int cwd_in_sbox = 0;
-    char root[PATH_MAX];
+
+    memcpy(p->buf, opt_root, opt_root_len);
+    p->len = 0;
+
+    // abspath, read in place
+    if (ptr == 0 || umovestr(tcp, ptr, PATH_MAX, hpn) <= 0) {
+        hpn[0] = '\0';
+        return -1;
+    }
+    if (hpn[0] == '\0') {
+        return -1;
+    }
+    if (hpn[0] == '/') {
+        p->len = normalize_path(hpn);
+        return 0;
+    }
+
+    // relpath, so resolve it
+    char pn[PATH_MAX];
+    int len = strlen(hpn);
+    memcpy(pn, hpn, len + 1);
+
     if (fd == AT_FDCWD) {
-        // read /proc/pid/cwd
-        cwd_in_sbox = get_cwd_hpn(tcp->pid, root, sizeof(root));
+        // cached, or read /proc/pid/cwd
+        cwd_in_sbox = get_cwd_hpn(tcp, p);
     } else {
         // read /proc/pid/fd/#
-        cwd_in_sbox = get_fd_hpn(tcp->pid, fd, root, sizeof(root));
+        cwd_in_sbox = get_fd_hpn(tcp, fd, p);
+    }
+    memcpy(p->buf, opt_root, opt_root_len);
+
+    // dir/pn, which may only fit once normalized (../)
+    if (p->len + 1 + len >= PATH_MAX) {
+        char full[2 * PATH_MAX];
+
+        memcpy(full, hpn, p->len);
+        full[p->len] = '/';
+        memcpy(full + p->len + 1, pn, len + 1);
+        len = normalize_path(full);
+        if (len >= PATH_MAX) {
+            hpn[0] = '\0';
+            p->len = 0;
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(hpn, full, len + 1);
+        p->len = len;
+        return cwd_in_sbox;
     }
-
-    snprintf(path, len, "%s/%s", root, pn);
-    normalize_path(path);
+    hpn[p->len] = '/';
+    memcpy(hpn + p->len + 1, pn, len + 1);
+    p->len = normalize_path(hpn);
 
     return cwd_in_sbox;
 }
 
+//
+// the path arg of this syscall, resolved once: its entry and exit get
+// the same one (see struct sbox_call)
+//
 static
-void get_spn_from_hpn(char *hpn, char *spn, int len)
+struct sbox_call *sbox_resolve(struct tcb *tcp, int fd, int arg)
 {
-    snprintf(spn, len, "%s%s", opt_root, hpn);
+    struct sbox_call *call = tcp->call;
+
+    if (!call) {
+        call = tcp->call = safe_malloc(sizeof(*call));
+        call->arg = -1;
+    }
+    if (call->arg != arg) {
+        call->ret = get_path_from_fd_and_arg(tcp, fd, arg, &call->path);
+        call->err = call->ret < 0 ? errno : 0;
+        call->arg = arg;
+        call->flags = 0;
+    }
+    return call;
+}
+
+void sbox_free_call(struct tcb *tcp)
+{
+    free(tcp->call);
+    tcp->call = NULL;
 }
 
 static
@@ -426,65 +1436,177 @@ void set_regs_with_arg(struct user_regs_struct *regs, int arg, long val)
     }
 }
 
-#ifdef SBOX_USE_WRITEV
-void sbox_remote_write(struct tcb *tcp, long ptr, char *buf, int len)
+struct sbox_inject {
+    struct user_regs_struct regs;  /* regs to resume the tracee with */
+    long nr;                       /* syscall run in place of its own */
+};
+
+/* address space of a new process image; the scratch is mapped lazily */
+struct sbox_mm *sbox_new_mm(void)
+{
+    struct sbox_mm *mm = safe_malloc(sizeof(*mm));
+
+    memset(mm, 0, sizeof(*mm));
+    mm->refcnt = 1;
+    mm->scratch = -1;
+    mm->memfd = -1;
+    return mm;
+}
+
+/* release the slot of the tcb and its reference to the address space */
+void sbox_put_mm(struct tcb *tcp)
 {
-    struct iovec local[1], remote[1];
+    struct sbox_mm *mm = tcp->mm;
+    int i;
 
-    local[0].iov_base  = (void*)buf;
-    local[0].iov_len   = len;
-    remote[0].iov_base = (void*)ptr;
-    remote[0].iov_len  = len;
+    if (!mm) {
+        return;
+    }
+    if (tcp->slot >= 0) {
+        mm->busy &= ~(1ULL << tcp->slot);
+    }
+    if (tcp->inject) {
+        if (tcp->inject->nr != __NR_sched_yield) {
+            mm->injecting = 0;
+        }
+        free(tcp->inject);
+        tcp->inject = NULL;
+    }
+    tcp->slot = SLOT_NONE;
+    tcp->mm = NULL;
 
-    if (process_vm_writev(tcp->pid, local, 1, remote, 1, 0) < 0) {
-        err(1, "writev failed: pid=%d", tcp->pid);
+    if (--mm->refcnt > 0) {
+        return;
     }
+    if (mm->memfd >= 0) {
+        close(mm->memfd);
+    }
+    for (i = 0; i < SCRATCH_SLOTS; i ++) {
+        free(mm->slot_data[i]);
+    }
+    free(mm);
 }
-#else
-void sbox_remote_write(struct tcb *tcp, long ptr, char *buf, int len)
+
+/* the address space of a new child: the parent's one, or a copy of it */
+void sbox_inherit_mm(struct tcb *child, struct tcb *parent, int shared)
+{
+    struct sbox_mm *mm = parent->mm;
+
+    // the child already mapped a scratch of its own, keep using it
+    if (!mm || !child->mm || child->mm->scratch != -1
+        || child->mm->injecting || child->slot != SLOT_NONE) {
+        return;
+    }
+
+    sbox_put_mm(child);
+    if (shared) {
+        mm->refcnt ++;
+        child->mm = mm;
+        return;
+    }
+
+    // fork() copies the mapping, but not which slots are busy
+    child->mm = sbox_new_mm();
+    child->mm->scratch = mm->scratch;
+    child->mm->sealed = mm->sealed;
+    child->mm->inject_failed = mm->inject_failed;
+}
+
+/* /proc/pid/mem of the address space, or -1 */
+static
+int sbox_mm_memfd(struct tcb *tcp)
+{
+    struct sbox_mm *mm = tcp->mm;
+    char proc[64];
+
+    if (!mm || mm->memfd == -2) {
+        return -1;
+    }
+    if (mm->memfd == -1) {
+        snprintf(proc, sizeof(proc), "/proc/%d/mem", tcp->pid);
+        mm->memfd = open(proc, O_RDWR | O_CLOEXEC);
+        if (mm->memfd < 0) {
+            dbg(info, "can't open %s, use ptrace poke", proc);
+            mm->memfd = -2;
+            return -1;
+        }
+    }
+    return mm->memfd;
+}
+
+static
+void sbox_poke_write(struct tcb *tcp, long ptr, char *buf, int len)
 {
-    // off
-    // [..bb]...[ee..]
-    //    ^        ^
-    //    +-- ptr  |
-    // [byte]      |
-    //             rear
-    //
+    while (len > 0) {
+        long off = ptr % sizeof(long);
+        int n = min(len, (int)(sizeof(long) - off));
+        long word;
 
-    long off = ptr % 8;
-    if (off) {
-        int i;
-        long read = ptrace(PTRACE_PEEKDATA, tcp->pid, ptr - off, 0, 0);
-        for (i = off; i < 8 - off; i ++) {
-            *((char *)&read + i) = buf[i - off];
+        // keep the bytes around a partial word
+        if (n < (int)sizeof(long)) {
+            word = ptrace(PTRACE_PEEKDATA, tcp->pid, ptr - off, 0);
         }
-        ptrace(PTRACE_POKEDATA, tcp->pid, ptr - off, read, 0);
+        memcpy((char *)&word + off, buf, n);
+        ptrace(PTRACE_POKEDATA, tcp->pid, ptr - off, word);
 
-        len -= 8 - off;
-        ptr += 8 - off;
-        buf += 8 - off;
+        ptr += n;
+        buf += n;
+        len -= n;
     }
+}
+
+//
+// write to the tracee in a single call. unlike process_vm_writev(),
+// /proc/pid/mem also writes to its read-only mappings (the scratch).
+//
+void sbox_remote_write(struct tcb *tcp, long ptr, char *buf, int len)
+{
+    int fd;
+
+    // not stopped for a notification (-u), and only ever writing
+    // to its own buffers (e.g., struct stat)
+    if (tcp->flags & TCB_NOTIFY) {
+        struct iovec local = { buf, len };
+        struct iovec remote = { (void *)ptr, len };
+        process_vm_writev(tcp->pid, &local, 1, &remote, 1, 0);
+        return;
+    }
+
+    fd = sbox_mm_memfd(tcp);
 
-    for (; len > 0; len -= 8, buf += 8, ptr += 8) {
-        ptrace(PTRACE_POKEDATA, tcp->pid, ptr, *(long *)(buf), 0);
+    if (fd >= 0 && pwrite(fd, buf, len, ptr) == len) {
+        return;
     }
+    sbox_poke_write(tcp, ptr, buf, len);
+}
 
-    if (len > 0) {
-        int i;
-        long read = ptrace(PTRACE_PEEKDATA, tcp->pid, ptr, 0, 0);
-        for (i = 0; i < len; i ++) {
-            *((char *)&read + i) = buf[i];
+/* complete the regs, e.g., before they are written back as a whole */
+static
+void sbox_get_full_regs(struct tcb *tcp)
+{
+    if (tcp->flags & TCB_REGS_PARTIAL) {
+        if (ptrace(PTRACE_GETREGS, tcp->pid, 0, &tcp->regs) < 0) {
+            err(1, "failed to get regs of pid=%d", tcp->pid);
         }
-        ptrace(PTRACE_POKEDATA, tcp->pid, ptr, read, 0);
+        tcp->flags &= ~TCB_REGS_PARTIAL;
     }
 }
-#endif
 
 void sbox_rewrite_arg(struct tcb *tcp, int arg, long val)
 {
-    struct user_regs_struct *regs = &tcp->regs;
-    set_regs_with_arg(regs, arg, val);
-    ptrace(PTRACE_SETREGS, tcp->pid, 0, regs);
+    sbox_get_full_regs(tcp);
+    set_regs_with_arg(&tcp->regs, arg, val);
+    tcp->flags |= TCB_REGS_DIRTY;
+}
+
+/* write back the rewritten regs once, before the tracee is resumed */
+void sbox_flush_regs(struct tcb *tcp)
+{
+    /* regs are just a copy in the notification mode */
+    if ((tcp->flags & (TCB_REGS_DIRTY | TCB_NOTIFY)) == TCB_REGS_DIRTY) {
+        ptrace(PTRACE_SETREGS, tcp->pid, 0, &tcp->regs);
+    }
+    tcp->flags &= ~(TCB_REGS_PARTIAL | TCB_REGS_DIRTY);
 }
 
 void sbox_rewrite_ret(struct tcb *tcp, long long ret)
@@ -497,55 +1619,255 @@ void sbox_rewrite_ret(struct tcb *tcp, long long ret)
     sbox_rewrite_arg(tcp, ARG_RET, ret);
 }
 
-void sbox_hijack_str(struct tcb *tcp, int arg, char *new)
+/* strings hijacked in this stop, written by sbox_flush_stage() */
+static char sbox_stage[SCRATCH_SLOT_SIZE];
+
+/* pick where the strings of this syscall go */
+static
+void sbox_take_slot(struct tcb *tcp)
+{
+    struct sbox_mm *mm = tcp->mm;
+    int i = tcp->slot_hint;
+
+    if (mm->scratch != -1 && (mm->busy & (1ULL << i))) {
+        for (i = 0; i < SCRATCH_SLOTS && (mm->busy & (1ULL << i)); i ++);
+    }
+
+    // never anywhere the tracee can write to: it was mapped (and a
+    // slot freed) before the handler ran, see. sbox_inject_enter()
+    if (mm->scratch == -1 || mm->inject_failed || i == SCRATCH_SLOTS
+        || (os_seal && !mm->sealed)) {
+        sbox_stop(tcp, "No scratch mapping to hijack paths");
+    }
+
+    mm->busy |= 1ULL << i;
+    tcp->slot = tcp->slot_hint = i;
+    tcp->stage_addr = mm->scratch + (long)i * SCRATCH_SLOT_SIZE;
+}
+
+/* stage a string to write, and return its address in the tracee */
+static
+long sbox_stage_str(struct tcb *tcp, char *str, int len)
+{
+    len ++;                        /* and its NUL */
+
+    if (tcp->slot == SLOT_NONE) {
+        sbox_take_slot(tcp);
+    }
+    if (tcp->stage_len + len > SCRATCH_SLOT_SIZE) {
+        sbox_stop(tcp, "Too long paths to hijack: %s", str);
+    }
+
+    memcpy(sbox_stage + tcp->stage_len, str, len);
+    tcp->stage_len += len;
+    return tcp->stage_addr + tcp->stage_len - len;
+}
+
+/* write the staged strings at once, unless the slot already has them */
+void sbox_flush_stage(struct tcb *tcp)
+{
+    struct sbox_mm *mm = tcp->mm;
+    int len = tcp->stage_len;
+    int i = tcp->slot;
+
+    if (!len) {
+        return;
+    }
+    tcp->stage_len = 0;
+
+    if (mm->slot_len[i] == len
+        && memcmp(mm->slot_data[i], sbox_stage, len) == 0) {
+        return;
+    }
+
+    sbox_remote_write(tcp, tcp->stage_addr, sbox_stage, len);
+    if (!mm->slot_data[i]) {
+        mm->slot_data[i] = safe_malloc(SCRATCH_SLOT_SIZE);
+    }
+    memcpy(mm->slot_data[i], sbox_stage, len);
+    mm->slot_len[i] = len;
+}
+
+void sbox_hijack_str(struct tcb *tcp, int arg, char *new, int len)
+{
+    int n = tcp->hijacked;
+    tcp->hijacked_args[n] = arg;
+    tcp->hijacked_vals[n] = tcp->u_arg[arg];
+    tcp->hijacked ++;
+
+    /* the supervisor performs the syscall with the new path */
+    if (tcp->flags & TCB_NOTIFY) {
+        sbox_notify_hijack_str(tcp, arg, new, len);
+        return;
+    }
+
+    sbox_rewrite_arg(tcp, arg, sbox_stage_str(tcp, new, len));
+}
+
+//
+// fail the syscall as the kernel fails a path of PATH_MAX or more, by
+// hijacking the arg with one: what the tracee gave fits, but its path
+// (relative to a deep dir) doesn't
+//
+static
+void sbox_hijack_too_long(struct tcb *tcp, int arg)
+{
+    char pn[PATH_MAX + 1];
+
+    memset(pn, '/', PATH_MAX);
+    pn[PATH_MAX] = '\0';
+    sbox_hijack_str(tcp, arg, pn, PATH_MAX);
+}
+
+void sbox_hijack_arg(struct tcb *tcp, int arg, long new)
+{
+    int n = tcp->hijacked;
+    tcp->hijacked_args[n] = arg;
+    tcp->hijacked_vals[n] = tcp->u_arg[arg];
+    tcp->hijacked ++;
+
+    /* the supervisor performs the syscall with the new arg */
+    if (tcp->flags & TCB_NOTIFY) {
+        tcp->u_arg[arg] = new;
+        return;
+    }
+
+    sbox_rewrite_arg(tcp, arg, new);
+}
+
+//
+// at the entry of a syscall, run another one in its place and rewind
+// the tracee to its syscall instruction once it's done (see.
+// sbox_inject_stop()):
+//
+//  - mmap()      : the scratch, before any path is hijacked
+//  - mseal()     : the scratch, so no munmap(), mprotect(), mremap()
+//                  or mmap() over it has to be stopped at (os_seal)
+//  - sched_yield(): another thread maps the scratch, or all its slots
+//                  are busy, so retry once they may not be
+//
+// return 1 if the handler of the syscall shouldn't run this time
+//
+int sbox_inject_enter(struct tcb *tcp)
 {
+    struct sbox_mm *mm = tcp->mm;
     struct user_regs_struct *regs = &tcp->regs;
+    long nr;
 
-    int n = tcp->hijacked;
-    tcp->hijacked_args[n] = arg;
-    tcp->hijacked_vals[n] = tcp->u_arg[arg];
-    tcp->hijacked ++;
-
-    /* write to the readonly memory to avoid race */
-    long new_ptr;
-    if (tcp->readonly_ptr == -1) {
-        new_ptr = regs->rsp - PATH_MAX * (arg+1);
+    if (!mm || mm->inject_failed) {
+        return 0;
+    }
+    if (mm->injecting || mm->busy == ~0ULL) {
+        nr = __NR_sched_yield;
+    } else if (mm->scratch == -1) {
+        nr = __NR_mmap;
+    } else if (os_seal && !mm->sealed) {
+        nr = __NR_mseal;
     } else {
-        //
-        // FIXME. PATH_MAX is the correct value, but it is
-        // big enough to overwrite important things in the
-        // elf header. so use 256 for now, in fact, there
-        // are just few syscalls hijacking multiple args.
-        //
-        new_ptr = tcp->readonly_ptr + 256 * arg;
+        return 0;
     }
 
-    sbox_remote_write(tcp, new_ptr, new, strlen(new)+1);
-    sbox_rewrite_arg(tcp, arg, new_ptr);
+    sbox_get_full_regs(tcp);
+
+    tcp->inject = safe_malloc(sizeof(*tcp->inject));
+    tcp->inject->regs = *regs;
+    tcp->inject->nr = nr;
+
+    regs->orig_rax = nr;
+    switch (nr) {
+    case __NR_mmap:
+        mm->injecting = 1;
+        regs->rdi = 0;
+        regs->rsi = SCRATCH_SIZE;
+        regs->rdx = PROT_READ;
+        regs->r10 = MAP_PRIVATE | MAP_ANONYMOUS;
+        regs->r8  = -1;
+        regs->r9  = 0;
+        break;
+    case __NR_mseal:
+        mm->injecting = 1;
+        regs->rdi = mm->scratch;
+        regs->rsi = SCRATCH_SIZE;
+        regs->rdx = 0;
+        break;
+    }
+    tcp->flags |= TCB_REGS_DIRTY;
+    return 1;
 }
 
-
-void sbox_hijack_arg(struct tcb *tcp, int arg, long new)
+/* the exit of the injected syscall, 0 if it's not one */
+int sbox_inject_stop(struct tcb *tcp)
 {
-    int n = tcp->hijacked;
-    tcp->hijacked_args[n] = arg;
-    tcp->hijacked_vals[n] = tcp->u_arg[arg];
-    tcp->hijacked ++;
+    struct sbox_inject *inject = tcp->inject;
+    struct sbox_mm *mm = tcp->mm;
+    struct user_regs_struct regs;
+    long ret;
 
-    sbox_rewrite_arg(tcp, arg, new);
+    if (!exiting(tcp)
+        || ptrace(PTRACE_GETREGS, tcp->pid, 0, &regs) < 0) {
+        return 0;
+    }
+    ret = regs.rax;
+
+    switch (inject->nr) {
+    case __NR_mmap:
+        if ((unsigned long)ret > -4096UL) {
+            dbg(info, "failed to map the scratch: pid=%d, %ld", tcp->pid, ret);
+            mm->inject_failed = 1;
+        } else {
+            dbg(info, "scratch of pid=%d: 0x%lx", tcp->pid, ret);
+            mm->scratch = ret;
+        }
+        mm->injecting = 0;
+        break;
+    case __NR_mseal:
+        if (ret != 0) {
+            dbg(info, "failed to seal the scratch: pid=%d, %ld", tcp->pid, ret);
+            mm->inject_failed = 1;
+        } else {
+            mm->sealed = 1;
+        }
+        mm->injecting = 0;
+        break;
+    }
+
+    // back to the syscall instruction, to enter the tracee's own again
+    tcp->regs = inject->regs;
+    tcp->regs.rip -= 2;
+    tcp->regs.rax = inject->regs.orig_rax;
+    tcp->regs.orig_rax = -1;       /* not a syscall to restart */
+    tcp->flags &= ~(TCB_INSYSCALL | TCB_REGS_PARTIAL);
+    tcp->flags |= TCB_REGS_DIRTY;
+
+    free(inject);
+    tcp->inject = NULL;
+    return 1;
 }
 
 void sbox_restore_hijack(struct tcb *tcp)
 {
+    struct sbox_mm *mm = tcp->mm;
     int i;
+
     for (i = 0; i < tcp->hijacked; i ++) {
         sbox_rewrite_arg(tcp, tcp->hijacked_args[i], tcp->hijacked_vals[i]);
     }
     tcp->hijacked = 0;
+
+    if (!mm || tcp->slot == SLOT_NONE) {
+        return;
+    }
+    if (tcp->slot >= 0) {
+        mm->busy &= ~(1ULL << tcp->slot);
+    }
+    tcp->slot = SLOT_NONE;
 }
 
-void sbox_sync_parent_dirs(char *hpn, char *spn)
+void sbox_sync_parent_dirs(struct sbox_path *p)
 {
+    char *hpn = sbox_hpn(p);
+    char *spn = sbox_spn(p);
+
     // already synced
     if (exists_parent_dir(spn)) {
         return;
@@ -559,7 +1881,7 @@ void sbox_sync_parent_dirs(char *hpn, char *spn)
     dbg(path, "sync path '%s'", hpn);
 
     // find the last / and split for a while
-    char *last = spn + strlen(spn);
+    char *last = spn + sbox_spn_len(p);
     for (; *last != '/' && last >= spn; last --);
     if (*last != '/') {
         return;
@@ -586,6 +1908,7 @@ void sbox_sync_parent_dirs(char *hpn, char *spn)
             break;
         }
         mkdir(spn, hpn_stat.st_mode);
+        sbox_index_spn(spn, 0);
         if (done) {
             break;
         }
@@ -597,36 +1920,177 @@ void sbox_sync_parent_dirs(char *hpn, char *spn)
     *last = '/';
 }
 
+static
+int sbox_store_obj(byte *digest, char *obj)
+{
+    char hex[DIGEST_MAX_LEN*2+1];
+    int i;
+
+    for (i = 0; i < os_md5map.alg->len; i ++) {
+        snprintf(hex+i*2, 3, "%02x", (unsigned int)digest[i]);
+    }
+    return snprintf(obj, PATH_MAX, "%s/%.2s/%s", os_store, hex, hex+2)
+        < PATH_MAX;
+}
+
+/* the sandboxfs can't share blocks with the store, copy as without it */
+static
+void sbox_store_off(const char *what)
+{
+    warnx("store %s: %s, not used", what, strerror(errno));
+    os_store[0] = '\0';
+}
+
+//
+// copy-up through the store (-K): hpn is hashed first, and spn shares
+// the blocks of the file of that digest in the store (FICLONE), with
+// every sandbox that copied the same content up. the filesystem
+// breaks the sharing itself on the first write, so no link is left
+// for the tracee to write through. a miss is copied up from hpn, and
+// then shared into the store. 1 if copied, as copyfile().
+//
+static
+int sbox_copyup_shared(struct sbox_path *p, byte *digest)
+{
+    char obj[PATH_MAX];
+    struct stat st, now;
+    int fd, hashed;
+
+    fd = open(sbox_hpn(p), O_RDONLY);
+    if (fd < 0) {
+        return copyfile(sbox_hpn(p), sbox_spn(p), os_md5map.alg, digest);
+    }
+    hashed = fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+        && digest_fd(os_md5map.alg, fd, st.st_size, digest);
+    close(fd);
+    if (!hashed) {
+        return copyfile(sbox_hpn(p), sbox_spn(p), os_md5map.alg, digest);
+    }
+
+    if (!sbox_store_obj(digest, obj)) {
+        return copyfile(sbox_hpn(p), sbox_spn(p), NULL, NULL);
+    }
+    if (clonefile(obj, sbox_spn(p), st.st_mode & ~S_IFMT)) {
+        dbg(store, "shared %s: %s", obj, sbox_spn(p));
+        os_copyup.shared ++;
+        return 1;
+    }
+    if (errno != ENOENT) {
+        sbox_store_off(obj);
+    }
+
+    // a miss, the digest is kept unless hpn changed since hashed
+    if (!copyfile(sbox_hpn(p), sbox_spn(p), NULL, NULL)) {
+        return 0;
+    }
+    if (stat(sbox_hpn(p), &now) < 0
+        || now.st_ino != st.st_ino || now.st_size != st.st_size
+        || now.st_mtim.tv_sec != st.st_mtim.tv_sec
+        || now.st_mtim.tv_nsec != st.st_mtim.tv_nsec
+        || now.st_ctim.tv_sec != st.st_ctim.tv_sec
+        || now.st_ctim.tv_nsec != st.st_ctim.tv_nsec) {
+        fd = open(sbox_spn(p), O_RDONLY);
+        hashed = fd >= 0 && fstat(fd, &now) == 0
+            && digest_fd(os_md5map.alg, fd, now.st_size, digest);
+        if (fd >= 0) {
+            close(fd);
+        }
+        if (!hashed) {
+            return 1;
+        }
+        sbox_store_obj(digest, obj);
+    }
+    if (!os_store[0]) {
+        return 1;
+    }
+
+    // only whole files in the store (never over one another sandbox
+    // already shares)
+    *strrchr(obj, '/') = '\0';
+    mkdir(obj, 0755);
+    obj[strlen(obj)] = '/';
+    if (clonefile_link(sbox_spn(p), obj, 0444)) {
+        dbg(store, "added %s: %s", obj, sbox_hpn(p));
+    } else if (errno == EXDEV || errno == EOPNOTSUPP
+               || errno == EINVAL || errno == ENOTTY) {
+        sbox_store_off(os_store);
+    }
+    return 1;
+}
+
+//
+// copy hpn up to spn, unless another writer (or a previous syscall)
+// already did; serialized so concurrent writers never see a half
+// copied file.
+//
+static
+void sbox_copyup(struct sbox_path *p)
+{
+    byte digest[DIGEST_MAX_LEN];
+    struct timespec beg, end;
+    struct stat st;
+
+    pthread_mutex_lock(&os_copyup_lock);
+    sbox_index_spn(sbox_spn(p), 0);
+    if (!path_exists(sbox_spn(p))) {
+        clock_gettime(CLOCK_MONOTONIC, &beg);
+        if (os_store[0]
+            ? sbox_copyup_shared(p, digest)
+            : copyfile(sbox_hpn(p), sbox_spn(p),
+                       opt_md5 ? os_md5map.alg : NULL, digest)) {
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            os_copyup.files ++;
+            os_copyup.usec += (end.tv_sec - beg.tv_sec) * 1000000LL
+                + (end.tv_nsec - beg.tv_nsec) / 1000;
+            if (stat(sbox_spn(p), &st) == 0) {
+                os_copyup.bytes += st.st_size;
+            }
+            if (opt_md5) {
+                add_md5_to_map(&os_md5map, sbox_hpn(p), digest);
+                journal_append(&os_journal, META_DIGEST, sbox_hpn(p),
+                               digest, os_md5map.alg->len);
+            }
+        }
+    }
+    pthread_mutex_unlock(&os_copyup_lock);
+    sbox_check_meta();
+}
+
 int sbox_rewrite_path(struct tcb *tcp, int fd, int arg, int flag)
 {
-    char hpn[PATH_MAX];
-    char spn[PATH_MAX];
+    struct sbox_call *call = sbox_resolve(tcp, fd, arg);
+    struct sbox_path *p = &call->path;
+    char *hpn = sbox_hpn(p);
+    char *spn = sbox_spn(p);
 
-    if (get_hpn_from_fd_and_arg(tcp, fd, arg, hpn, PATH_MAX) == -1) {
+    if (call->ret == -1) {
+        if (call->err == ENAMETOOLONG) {
+            sbox_hijack_too_long(tcp, arg);
+        }
         return -1;
     }
-    get_spn_from_hpn(hpn, spn, PATH_MAX);
 
     // satisfying one of rewrite conditions
     if (flag != READWRITE_READ  \
         || sbox_is_deleted(hpn) \
-        || path_exists(spn)) {
+        || sbox_spn_exists(spn)) {
 
-        // to be written to spn, so sync parent paths
+        // to be written to spn, so sync parent paths; it can be a
+        // dir or a symlink (or renamed to), so anything may follow
         if (flag != READWRITE_READ) {
-            sbox_sync_parent_dirs(hpn, spn);
+            sbox_sync_parent_dirs(p);
+            sbox_index_spn(spn, INDEX_OPAQUE);
+            sbox_log_change(hpn);
         }
 
         // writing intent (not force)
         if (flag == READWRITE_WRITE) {
-            byte md5[MD5_DIGEST_LENGTH];
-            if (copyfile(hpn, spn, md5)) {
-                add_md5_to_map(&os_md5map, hpn, md5);
-            }
+            sbox_copyup(p);
         }
 
         // finally hijack path (arg)
-        sbox_hijack_str(tcp, arg, spn);
+        sbox_hijack_str(tcp, arg, spn, sbox_spn_len(p));
+        call->flags |= CALL_REWRITTEN;
 
         dbg(path, "rewrite to %s", spn);
     }
@@ -638,12 +2102,19 @@ static
 void sbox_open_enter(struct tcb *tcp, int fd, int arg, int oflag)
 {
     int cwd_in_sboxfs;
-    int accmode;
-    char hpn[PATH_MAX];
-    char spn[PATH_MAX];
-
-    cwd_in_sboxfs = get_hpn_from_fd_and_arg(tcp, fd, arg, hpn, PATH_MAX);
-    get_spn_from_hpn(hpn, spn, PATH_MAX);
+    int accmode = oflag & O_ACCMODE;
+    int writing = accmode != O_RDONLY || (oflag & (O_CREAT | O_TRUNC));
+    struct sbox_path p;
+    char *hpn = sbox_hpn(&p);
+    char *spn = sbox_spn(&p);
+
+    cwd_in_sboxfs = get_path_from_fd_and_arg(tcp, fd, arg, &p);
+    if (cwd_in_sboxfs < 0) {
+        if (errno == ENAMETOOLONG) {
+            sbox_hijack_too_long(tcp, arg);
+        }
+        return;
+    }
 
     // NOTE. ignore /dev and /proc
     //   /proc: need to emulate /proc/pid/fd/*
@@ -655,47 +2126,53 @@ void sbox_open_enter(struct tcb *tcp, int fd, int arg, int oflag)
     // if the path is deleted
     if (sbox_is_deleted(hpn)) {
         dbg(open, "open deleted file: %s", hpn);
-        sbox_sync_parent_dirs(hpn, spn);
-        sbox_hijack_str(tcp, arg, spn);
+        sbox_sync_parent_dirs(&p);
+        sbox_index_spn(spn, INDEX_OPAQUE);
+        if (writing) {
+            sbox_log_change(hpn);
+        }
+        sbox_hijack_str(tcp, arg, spn, sbox_spn_len(&p));
         return;
     }
 
     // whenever path exists in the sandbox, go to there
-    if (path_exists(spn)) {
+    if (sbox_spn_exists(spn)) {
         dbg(open, "exists in sbox: %s", spn);
-        sbox_hijack_str(tcp, arg, spn);
+        if (writing) {
+            sbox_log_change(hpn);
+        }
+        sbox_hijack_str(tcp, arg, spn, sbox_spn_len(&p));
         return;
     }
 
     // readonly, just use hostfs
-    accmode = oflag & O_ACCMODE;
     if (accmode == O_RDONLY) {
         // complicated situation arises if cwd in sboxfs
         if (cwd_in_sboxfs) {
             // rewrite abspath to open hpn (ignoring cwd effect)
             dbg(open, "writing back to hpn: %s", hpn);
-            sbox_hijack_str(tcp, arg, hpn);
+            sbox_hijack_str(tcp, arg, hpn, p.len);
         }
         return;
     }
 
-    // trunc or write only
-    if (oflag & O_TRUNC || accmode == O_WRONLY) {
+    // trunc, nothing to keep
+    if (oflag & O_TRUNC) {
         dbg(open, "open(%s, TRUNC)", spn);
-        sbox_sync_parent_dirs(hpn, spn);
-        sbox_hijack_str(tcp, arg, spn);
+        sbox_sync_parent_dirs(&p);
+        sbox_index_spn(spn, INDEX_OPAQUE);
+        sbox_log_change(hpn);
+        sbox_hijack_str(tcp, arg, spn, sbox_spn_len(&p));
         return;
     }
 
-    // write or read/write
-    if (accmode == O_RDWR || accmode == O_RDWR) {
-        byte md5[MD5_DIGEST_LENGTH];
-        dbg(open, "open(%s, RW)", spn);
-        sbox_sync_parent_dirs(hpn, spn);
-        if (copyfile(hpn, spn, md5)) {
-            add_md5_to_map(&os_md5map, hpn, md5);
-        }
-        sbox_hijack_str(tcp, arg, spn);
+    // write (e.g., append) or read/write, the data is written now
+    if (accmode == O_WRONLY || accmode == O_RDWR) {
+        dbg(open, "open(%s, W/RW)", spn);
+        sbox_sync_parent_dirs(&p);
+        sbox_log_change(hpn);
+        sbox_copyup(&p);
+        sbox_hijack_str(tcp, arg, spn, sbox_spn_len(&p));
     }
 }
 
@@ -740,6 +2217,14 @@ int sbox_newfstatat(struct tcb *tcp)
     return 0;
 }
 
+int sbox_statx(struct tcb *tcp)
+{
+    if (entering(tcp)) {
+        sbox_rewrite_path(tcp, tcp->u_arg[0], 1, READWRITE_READ);
+    }
+    return 0;
+}
+
 int sbox_mkdir(struct tcb *tcp)
 {
     if (entering(tcp)) {
@@ -763,12 +2248,11 @@ int sbox_rmdir(struct tcb *tcp)
     } else {
         // successfully delete a directory
         if (tcp->regs.rax == 0) {
-            char hpn[PATH_MAX];
-            get_hpn_from_fd_and_arg(tcp, AT_FDCWD, 0, hpn, PATH_MAX);
+            struct sbox_call *call = sbox_resolve(tcp, AT_FDCWD, 0);
 
             // clean up all files in the directory
-            // NOTE. can be optimized if need
-            __sbox_delete_dir(hpn);
+            __sbox_delete_dir(sbox_hpn(&call->path));
+            sbox_dirs_moved();
         }
     }
     return 0;
@@ -776,18 +2260,15 @@ int sbox_rmdir(struct tcb *tcp)
 
 int sbox_unlink_general(struct tcb *tcp, int fd, int arg, int flag)
 {
-    char hpn[PATH_MAX];
-    char spn[PATH_MAX];
-
     if (entering(tcp)) {
         sbox_rewrite_path(tcp, fd, arg, READWRITE_FORCE);
     } else {
-        // get hpn/spn
-        get_hpn_from_fd_and_arg(tcp, fd, arg, hpn, PATH_MAX);
-        get_spn_from_hpn(hpn, spn, PATH_MAX);
+        // hpn/spn as of the entry
+        struct sbox_call *call = sbox_resolve(tcp, fd, arg);
+        char *hpn = sbox_hpn(&call->path);
 
         // failed on sandbox
-        if ((long)tcp->regs.rax < 0) {
+        if ((call->flags & CALL_REWRITTEN) && (long)tcp->regs.rax < 0) {
             // emulate successful deletion
             if (!sbox_is_deleted(hpn) && path_exists(hpn)) {
                 dbg(path, "emulate successful unlink: %s", hpn);
@@ -799,6 +2280,7 @@ int sbox_unlink_general(struct tcb *tcp, int fd, int arg, int flag)
         if ((long)tcp->regs.rax == 0) {
             if (flag == AT_REMOVEDIR) {
                 __sbox_delete_dir(hpn);
+                sbox_dirs_moved();
             } else {
                 __sbox_delete_file(hpn);
             }
@@ -819,16 +2301,12 @@ int sbox_unlinkat(struct tcb *tcp)
 
 int sbox_access_general(struct tcb *tcp, int fd, int arg)
 {
-    char hpn[PATH_MAX];
-    char spn[PATH_MAX];
-
     if (entering(tcp)) {
         sbox_rewrite_path(tcp, fd, arg, READWRITE_READ);
     } else {
         // exiting and fakeroot enabled
         if (opt_fakeroot && tcp->regs.rax != 0) {
-            get_hpn_from_fd_and_arg(tcp, fd, arg, hpn, PATH_MAX);
-            get_spn_from_hpn(hpn, spn, PATH_MAX);
+            char *hpn = sbox_hpn(&sbox_resolve(tcp, fd, arg)->path);
 
             // if exists in host fs, return ok
             if (path_exists(hpn)) {
@@ -850,135 +2328,365 @@ int sbox_faccessat(struct tcb *tcp)
     return sbox_access_general(tcp, tcp->u_arg[0], 1);
 }
 
-int sbox_getdents(struct tcb *tcp)
+/* the file position of the tracee's fd, as /proc/pid/fdinfo/# reads */
+static
+long long get_fd_pos(struct tcb *tcp, int fd)
 {
-    static char buf[4096];
-    static char tmp[4096];
+    char proc[PATH_MAX];
+    long long pos = -1;
+    FILE *fp;
 
-    char spn[PATH_MAX];
-    char hpn[PATH_MAX];
-
-    // after pumping files on sandboxfs
-    if (exiting(tcp) && tcp->regs.rax == 0) {
-        int hostfd = tcp->u_arg[0];
-
-        // NOTE. we only support, a single contiguous getdent()
-        if (!(tcp->dentfd_sbox < 0) && tcp->dentfd_host != hostfd) {
-            dbg(getdents, "optimistically close(host:%d)", tcp->dentfd_host);
-            close(tcp->dentfd_sbox);
-            tcp->dentfd_sbox = -1;
-            tcp->dentfd_host = -1;
-            // should fall into the below if statement
-        }
-
-        // just done with sandboxfs
-        if (tcp->dentfd_sbox < 0) {
-            // get hpn
-            if (!get_fd_path(tcp->pid, hostfd, spn, sizeof(spn))) {
-                // wrong fd anyway
-                return 0;
-            }
+    snprintf(proc, sizeof(proc), "/proc/%d/fdinfo/%d", tcp->pid, fd);
+    if ((fp = fopen(proc, "r"))) {
+        if (fscanf(fp, "pos: %lld", &pos) != 1) {
+            pos = -1;
+        }
+        fclose(fp);
+    }
+    return pos;
+}
 
-            // check if calling to sandboxfs
-            if (strncmp(spn, opt_root, opt_root_len) != 0) {
-
-                // XXX. meanwhile, it can modify the same dir in sboxfs, so
-                // the getdents(hostfs) might be even wrong. we can handle
-                // this situation later.
-                ifdbg(getdents, {
-                        char xxx[PATH_MAX];
-                        snprintf(xxx, sizeof(PATH_MAX), "%s%s", opt_root, spn);
-                        if (access(xxx, F_OK) == 0) {
-                            dbg(getdents, "XXX. %s exists", xxx);
-                        }
-                    }
-                );
-
-                // return if calls on hostfs
-                return 0;
-            }
+//
+// the listing of the hostfs dir of spn, NULL if there is none. the
+// names in the sandboxfs are read from the tracee's dir, opened anew
+// through /proc (its own open file, and so its position, is shared
+// with any copy), or from spn if it can't be. a listing rewound (old)
+// starts over, but keeps the d_off given.
+//
+static
+struct sbox_dents *sbox_new_dents(struct tcb *tcp, int sboxfd,
+                                  char *spn, int spn_len,
+                                  struct sbox_dents *old)
+{
+    struct sbox_dents *dents;
+    char buf[32768];
+    char proc[PATH_MAX];
+    long long end;
+    int host, fd, n, off;
 
-            strncpy(hpn, spn + opt_root_len, sizeof(hpn));
-            strncpy(tcp->dentfd_spn, spn, sizeof(tcp->dentfd_spn));
+    host = open(spn + opt_root_len, O_RDONLY | O_DIRECTORY);
+    if (host < 0) {
+        sbox_free_dents(old);
+        return NULL;
+    }
+    end = get_fd_pos(tcp, sboxfd);
+    snprintf(proc, sizeof(proc), "/proc/%d/fd/%d", tcp->pid, sboxfd);
+    fd = open(proc, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        fd = open(spn, O_RDONLY | O_DIRECTORY);
+    }
+    if (fd < 0) {
+        close(host);
+        sbox_free_dents(old);
+        return NULL;
+    }
+
+    if (old) {
+        dents = old;
+        close(dents->host);
+        free_nameset(&dents->names);
+        dents->nr = 0;
+    } else {
+        dents = safe_malloc(sizeof(*dents));
+        memset(dents, 0, sizeof(*dents));
+    }
+    dents->host = host;
+    dents->end = end;
+    dents->len = spn_len - opt_root_len;
+    memcpy(dents->hpn, spn + opt_root_len, dents->len);
+    dents->hpn[dents->len] = '/';
+
+    // the names to hide in the hostfs dir, . and .. included
+    while ((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0) {
+        for (off = 0; off < n; ) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + off);
+            add_name_to_set(&dents->names, d->d_name, strlen(d->d_name));
+            off += d->d_reclen;
+        }
+    }
+    close(fd);
+
+    dbg(getdents, "merge %s (%u in sbox)", spn + opt_root_len,
+        HASH_COUNT(dents->names.entries));
+    return dents;
+}
 
-            tcp->dentfd_host = hostfd;
-            tcp->dentfd_sbox = open(hpn, O_RDONLY | O_DIRECTORY);
-            if (tcp->dentfd_sbox < 0) {
-                return 0;
+//
+// drop the records of [buf, buf+len) shadowed in the sandboxfs, in
+// place, and give the others our d_off
+//
+static
+int sbox_filter_dents(struct sbox_dents *dents, char *buf, int len, int is64)
+{
+    char *name = dents->hpn + dents->len + 1;
+    int deleted;
+    int src = 0;
+    int dst = 0;
+
+    pthread_rwlock_rdlock(&os_deleted_fs_lock);
+    deleted = !is_empty_fsmap(os_deleted_fs);
+    while (src < len) {
+        struct linux_dirent *d = (struct linux_dirent *)(buf + src);
+        int reclen = d->d_reclen;
+        char *d_name = is64 ? ((struct linux_dirent64 *)d)->d_name : d->d_name;
+        size_t n = strlen(d_name);
+
+        int hide = has_name_in_set(&dents->names, d_name, n);
+        if (!hide && deleted && dents->len + 1 + n < PATH_MAX) {
+            memcpy(name, d_name, n + 1);
+            hide = is_deleted(os_deleted_fs, dents->hpn);
+        }
+        if (!hide) {
+            off_t *d_off = is64 ? &((struct linux_dirent64 *)d)->d_off
+                                : &d->d_off;
+            if (dents->nr == dents->max) {
+                dents->max = dents->max ? 2 * dents->max : 256;
+                dents->offs = realloc(dents->offs,
+                                      dents->max * sizeof(*dents->offs));
+                if (!dents->offs) {
+                    die_out_of_memory();
+                }
             }
+            dents->offs[dents->nr ++] = *d_off;
+            if (dents->nr > dents->nums) {
+                dents->nums = dents->nr;
+            }
+            *d_off = SBOX_DENTS_OFF + dents->nr;
+            memmove(buf + dst, buf + src, reclen);
+            dst += reclen;
+        }
+        src += reclen;
+    }
+    pthread_rwlock_unlock(&os_deleted_fs_lock);
+
+    return dst;
+}
+
+/* the next records of the hostfs dir, as many as count takes */
+static
+int sbox_read_dents(struct sbox_dents *dents, int count, int is64)
+{
+    int size = min(count, DENTS_BUF_MAX);
+    int len = 0;
+    int n;
+
+    if (size > dents->size) {
+        free(dents->buf);
+        dents->buf = safe_malloc(size);
+        dents->size = size;
+    }
+
+    // filtered out records leave room for more
+    while (len < size) {
+        n = syscall(is64 ? SYS_getdents64 : SYS_getdents, dents->host,
+                    dents->buf + len, size - len);
+        if (n <= 0) {
+            // the end, or no room left for the next one (EINVAL)
+            break;
         }
+        len += sbox_filter_dents(dents, dents->buf + len, n, is64);
+    }
+    return len;
+}
+
+//
+// a dir in the sandboxfs lists its own entries first (the tracee's fd
+// is on the spn); once the kernel returns 0 for it, we go on with the
+// hostfs dir, as if they were one. the state is per fd, so listings
+// of several dirs may interleave.
+//
+static
+int sbox_getdents_general(struct tcb *tcp, int is64)
+{
+    struct sbox_files *files = tcp->files;
+    struct sbox_path p;
+    int fd = tcp->u_arg[0];
+    long ret = tcp->regs.rax;
+    int len;
 
-        dbg(getdents, "handle files on sboxfs (host:%d)", tcp->dentfd_host);
+    if (entering(tcp) || ret < 0 || !files || fd < 0) {
+        return 0;
+    }
 
-        // manually invoke getdents on hostfs.
-        // to overwrite less than the memory of tracee (dirp), we use
-        // buf with the size less that the given value (count).
-        int len = syscall(SYS_getdents, tcp->dentfd_sbox, buf,
-                          min(sizeof(buf), tcp->u_arg[2]));
+    // the sandboxfs dir, from its start (again, if rewound)
+    if (ret > 0) {
+        if (fd < files->nfds && files->fds[fd].dents) {
+            files->fds[fd].dents->nr = -1;
+        }
+        return 0;
+    }
 
-        // done with pumping dirs of sandboxfs
-        if (len == 0) {
-            dbg(getdents, "No more files in sbox, cloes host:%d", tcp->dentfd_host);
+    // a listing of a dir since closed, and its fd reused
+    if (fd < files->nfds && files->fds[fd].dents) {
+        sbox_fd_valid(tcp, fd);
+    }
 
-            close(tcp->dentfd_sbox);
-            tcp->dentfd_sbox = -1;
-            tcp->dentfd_host = -1;
+    // just done with the sandboxfs dir (again, if rewound)
+    if (fd >= files->nfds || !files->fds[fd].dents
+        || files->fds[fd].dents->nr < 0) {
+        len = get_fd_path(tcp, fd, sbox_spn(&p), PATH_MAX);
+        if (len < 0 || !is_in_sboxfs(sbox_spn(&p)) || fd >= files->nfds) {
+            // on hostfs, nothing to merge
+            return 0;
+        }
+        // the listing can't be kept along an fd we can't tell apart
+        if (!files->fds[fd].path) {
+            return 0;
+        }
+        files->fds[fd].dents = sbox_new_dents(tcp, fd, sbox_spn(&p), len,
+                                              files->fds[fd].dents);
+        if (!files->fds[fd].dents) {
             return 0;
         }
+    }
 
-        // filter dir contents
-        int dst_iter = 0;
-        int src_iter = 0;
-        while (src_iter < len) {
-            struct linux_dirent *d = (struct linux_dirent *)(buf + src_iter);
-            // ignore . and ..
-            if (d->d_name[0] == '.') {
-                if (d->d_name[1] == '\0' ||
-                    (d->d_name[1] == '.' && d->d_name[2] == '\0')) {
-                    src_iter += d->d_reclen;
-                    continue;
-                }
-            }
+    struct sbox_dents *dents = files->fds[fd].dents;
+    len = sbox_read_dents(dents, tcp->u_arg[2], is64);
+    if (len == 0) {
+        // kept along, for a seekdir() back into it
+        dbg(getdents, "no more files in host:%d", dents->host);
+        return 0;
+    }
 
-            snprintf(spn, sizeof(spn), "%s/%s", tcp->dentfd_spn, d->d_name);
-            // ignore if it is a deleted entry
-            if (sbox_is_deleted(spn + opt_root_len)) {
-                src_iter += d->d_reclen;
-                continue;
-            }
+    dbg(getdents, "return: %d", len);
+    sbox_rewrite_ret(tcp, len);
+    sbox_remote_write(tcp, tcp->u_arg[1], dents->buf, len);
+    return 0;
+}
 
-            // ignore dentry if exists in sandboxfs
-            if (path_exists(spn)) {
-                dbg(getdents, "[%3d] found in sbox: %s", src_iter, spn);
-                src_iter += d->d_reclen;
-                continue;
-            }
+int sbox_getdents(struct tcb *tcp)
+{
+    return sbox_getdents_general(tcp, 0);
+}
+
+int sbox_getdents64(struct tcb *tcp)
+{
+    return sbox_getdents_general(tcp, 1);
+}
+
+//
+// seekdir() to a hostfs record of a merged listing (our d_off) moves
+// host instead, and the tracee's fd to the end of the sandboxfs dir,
+// so getdents() goes on from there; any other seek starts the hostfs
+// listing over, as reading the sandboxfs dir again does. under -s, the
+// filter only stops at offsets with the bit of SBOX_DENTS_OFF.
+//
+int sbox_lseek(struct tcb *tcp)
+{
+    struct sbox_files *files = tcp->files;
+    struct sbox_dents *dents;
+    int fd = tcp->u_arg[0];
+    long long off = tcp->u_arg[1];
+    int whence = tcp->u_arg[2];
 
-            // copy to dest
-            memcpy(tmp + dst_iter, buf + src_iter, d->d_reclen);
-            src_iter += d->d_reclen;
-            dst_iter += d->d_reclen;
+    if (exiting(tcp)) {
+        // where the tracee asked to be
+        if (tcp->hijacked && (long)tcp->regs.rax >= 0) {
+            sbox_rewrite_ret(tcp, tcp->hijacked_vals[0]);
         }
+        return 0;
+    }
 
-        // copy buf/ret to tracee
-        dbg(getdents, "return: %d", dst_iter);
-        sbox_rewrite_ret(tcp, dst_iter);
-        sbox_remote_write(tcp, tcp->u_arg[1], tmp, dst_iter);
+    if (!files || fd < 0 || fd >= files->nfds || !files->fds[fd].dents
+        || !sbox_fd_valid(tcp, fd) || (whence == SEEK_CUR && off == 0)) {
+        return 0;
     }
 
+    dents = files->fds[fd].dents;
+    if (whence == SEEK_SET && dents->end >= 0 && off > SBOX_DENTS_OFF
+        && off - SBOX_DENTS_OFF <= dents->nums) {
+        int nr = off - SBOX_DENTS_OFF;
+        if (lseek(dents->host, dents->offs[nr - 1], SEEK_SET) >= 0) {
+            dbg(getdents, "seek host:%d to #%d", dents->host, nr);
+            dents->nr = nr;
+            sbox_hijack_arg(tcp, 1, dents->end);
+            return 0;
+        }
+    }
+    dents->nr = -1;
     return 0;
 }
 
 /*
  * allows chdir into sboxfs or hostfs since we sanitize getcwd()
  *
- * NOTE. fchdir() doesn't need to be handled because open() already
+ * NOTE. fchdir() doesn't need to rewrite its fd because open() already
  * rewrites the path if needed.
  */
 int sbox_chdir(struct tcb *tcp)
 {
     if (entering(tcp)) {
         sbox_rewrite_path(tcp, AT_FDCWD, 0, READWRITE_READ);
+    } else if (!tcp->u_error) {
+        sbox_cwd_changed(tcp);
+    }
+    return 0;
+}
+
+int sbox_fchdir(struct tcb *tcp)
+{
+    if (exiting(tcp) && !tcp->u_error) {
+        sbox_cwd_changed(tcp);
+    }
+    return 0;
+}
+
+int sbox_close(struct tcb *tcp)
+{
+    // the fd is released even if close() fails
+    if (entering(tcp)) {
+        sbox_forget_fd(tcp, tcp->u_arg[0]);
+    }
+    return 0;
+}
+
+int sbox_dup2(struct tcb *tcp)
+{
+    // newfd is closed, if it was open
+    if (entering(tcp)) {
+        sbox_forget_fd(tcp, tcp->u_arg[1]);
+    }
+    return 0;
+}
+
+int sbox_dup3(struct tcb *tcp)
+{
+    return sbox_dup2(tcp);
+}
+
+#ifndef CLOSE_RANGE_UNSHARE
+# define CLOSE_RANGE_UNSHARE (1U << 1)
+#endif
+#ifndef CLOSE_RANGE_CLOEXEC
+# define CLOSE_RANGE_CLOEXEC (1U << 2)
+#endif
+
+int sbox_close_range(struct tcb *tcp)
+{
+    unsigned int fd = tcp->u_arg[0];
+    unsigned int last = tcp->u_arg[1];
+    unsigned int flags = tcp->u_arg[2];
+
+    if (!entering(tcp) || !tcp->files) {
+        return 0;
+    }
+    if (flags & CLOSE_RANGE_UNSHARE) {
+        sbox_unshare_files(tcp);
+    }
+    // closed by execve(), which drops them all anyway
+    if (flags & CLOSE_RANGE_CLOEXEC) {
+        return 0;
+    }
+    for (; fd <= last && fd < tcp->files->nfds; fd ++) {
+        sbox_forget_fd(tcp, fd);
+    }
+    return 0;
+}
+
+int sbox_unshare(struct tcb *tcp)
+{
+    if (exiting(tcp) && !tcp->u_error && (tcp->u_arg[0] & CLONE_FILES)) {
+        sbox_unshare_files(tcp);
     }
     return 0;
 }
@@ -987,6 +2695,13 @@ int sbox_getcwd(struct tcb *tcp)
 {
     // ret = len(buf)
     const long ret = tcp->regs.rax;
+    struct sbox_fs *fs = tcp->fs;
+
+    // the cwd is known, nothing to hide
+    if (exiting(tcp) && ret > 0
+        && fs && fs->valid && fs->gen == os_dirs_gen && !fs->in_sbox) {
+        return 0;
+    }
 
     if (exiting(tcp) && ret > 0) {
         char pn[PATH_MAX];
@@ -1002,26 +2717,84 @@ int sbox_getcwd(struct tcb *tcp)
             sbox_rewrite_ret(tcp, ret - opt_root_len);
         }
     }
-    return 0;
+    return 0;
+}
+
+#ifndef RENAME_EXCHANGE
+# define RENAME_EXCHANGE (1 << 1)
+#endif
+
+/* whether the path is a dir in the sandbox: its spn, or its hpn */
+static
+int sbox_is_dir(struct sbox_path *p)
+{
+    struct stat st;
+
+    if (sbox_spn_exists(sbox_spn(p))) {
+        return lstat(sbox_spn(p), &st) == 0 && S_ISDIR(st.st_mode);
+    }
+    return !sbox_is_deleted(sbox_hpn(p))
+        && lstat(sbox_hpn(p), &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+//
+// the source is only read, unless RENAME_EXCHANGE moves the target to
+// it: both are copied up then. a dir only in the hostfs can't be
+// copied up, so the exchange fails (EINVAL, by invalid flags).
+//
+static
+void sbox_rename_enter(struct tcb *tcp, int ofd, int oarg, int nfd, int narg,
+                       int flags)
+{
+    struct sbox_path *p = &sbox_resolve(tcp, ofd, oarg)->path;
+    int exchange = flags & RENAME_EXCHANGE;
+    int moves_dir = sbox_is_dir(p);
+    int host_dir = moves_dir && !sbox_spn_exists(sbox_spn(p));
+
+    sbox_rewrite_path(tcp, ofd, oarg,
+                      exchange ? READWRITE_WRITE : READWRITE_READ);
+
+    p = &sbox_resolve(tcp, nfd, narg)->path;
+    if (exchange && sbox_is_dir(p)) {
+        moves_dir = 1;
+        host_dir |= !sbox_spn_exists(sbox_spn(p));
+    }
+    sbox_rewrite_path(tcp, nfd, narg, READWRITE_WRITE);
+
+    if (exchange && host_dir) {
+        dbg(path, "exchange with a dir in the hostfs: %s", sbox_hpn(p));
+        sbox_hijack_arg(tcp, 4, -1);
+    }
+    if (moves_dir) {
+        tcp->call->flags |= CALL_MOVES_DIR;
+    }
+}
+
+/* a dir moved, the cached paths below it are stale */
+static
+void sbox_rename_exit(struct tcb *tcp)
+{
+    if (tcp->call && (tcp->call->flags & CALL_MOVES_DIR)
+        && (long)tcp->regs.rax == 0) {
+        sbox_dirs_moved();
+    }
 }
 
 int sbox_rename(struct tcb *tcp)
 {
 
     if (entering(tcp)) {
-        char hpn[PATH_MAX];
-        char spn[PATH_MAX];
+        // resolved once, sbox_rewrite_path() below reuses it
+        struct sbox_path *p = &sbox_resolve(tcp, AT_FDCWD, 0)->path;
 
-        get_hpn_from_fd_and_arg(tcp, AT_FDCWD, 0, hpn, PATH_MAX);
-        get_spn_from_hpn(hpn, spn, PATH_MAX);
-
-        if (!path_exists(hpn) && !path_exists(spn)) {
+        if (!path_exists(sbox_hpn(p)) && !sbox_spn_exists(sbox_spn(p))) {
             dbg(xxx, "XXXXXXXXXXX:%d", 0);
             return 0;
         }
 
-        sbox_rewrite_path(tcp, AT_FDCWD, 0, READWRITE_READ);
-        sbox_rewrite_path(tcp, AT_FDCWD, 1, READWRITE_WRITE);
+        sbox_rename_enter(tcp, AT_FDCWD, 0, AT_FDCWD, 1, 0);
+    } else {
+        sbox_rename_exit(tcp);
     }
     return 0;
 }
@@ -1029,8 +2802,20 @@ int sbox_rename(struct tcb *tcp)
 int sbox_renameat(struct tcb *tcp)
 {
     if (entering(tcp)) {
-        sbox_rewrite_path(tcp, tcp->u_arg[0], 1, READWRITE_READ);
-        sbox_rewrite_path(tcp, tcp->u_arg[2], 3, READWRITE_WRITE);
+        sbox_rename_enter(tcp, tcp->u_arg[0], 1, tcp->u_arg[2], 3, 0);
+    } else {
+        sbox_rename_exit(tcp);
+    }
+    return 0;
+}
+
+int sbox_renameat2(struct tcb *tcp)
+{
+    if (entering(tcp)) {
+        sbox_rename_enter(tcp, tcp->u_arg[0], 1, tcp->u_arg[2], 3,
+                          tcp->u_arg[4]);
+    } else {
+        sbox_rename_exit(tcp);
     }
     return 0;
 }
@@ -1064,18 +2849,12 @@ int sbox_symlink(struct tcb *tcp)
     // for example, if relative -> just use
     //              if absolute -> resolve the path
     char old_hpn[PATH_MAX];
-    // char old_spn[PATH_MAX];
-    char new_hpn[PATH_MAX];
-    char new_spn[PATH_MAX];
 
     if (entering(tcp)) {
         if (umovestr(tcp, tcp->u_arg[0], PATH_MAX, old_hpn) <= 0) {
             sbox_stop(tcp, "failed to copy from symlink");
         }
 
-        get_hpn_from_fd_and_arg(tcp, AT_FDCWD, 1, new_hpn, PATH_MAX);
-        get_spn_from_hpn(new_hpn, new_spn, PATH_MAX);
-
         // XXX. check if new_spn/../old_hpn
         if (strncmp(old_hpn, "..", 2) != 0) {
             sbox_stop(tcp, "XXX");
@@ -1189,212 +2968,813 @@ int sbox_getroot(struct tcb *tcp)
 
 int sbox_chown_general(struct tcb *tcp, int fd, int arg)
 {
-    if (entering(tcp)) {
-        sbox_rewrite_path(tcp, fd, arg, READWRITE_WRITE);
-    } else {
-        // exiting and fakeroot enabled
-        if (opt_fakeroot && tcp->regs.rax == -EPERM) {
-            dbg(fakeroot, "chown(fd:%d) = 0", fd);
-            sbox_rewrite_ret(tcp, 0);
+    if (entering(tcp)) {
+        sbox_rewrite_path(tcp, fd, arg, READWRITE_WRITE);
+    } else {
+        // exiting and fakeroot enabled
+        if (opt_fakeroot && tcp->regs.rax == -EPERM) {
+            dbg(fakeroot, "chown(fd:%d) = 0", fd);
+            sbox_rewrite_ret(tcp, 0);
+        }
+    }
+    return 0;
+}
+
+int sbox_chown(struct tcb *tcp)
+{
+    return sbox_chown_general(tcp, AT_FDCWD, 0);
+}
+
+int sbox_lchown(struct tcb *tcp)
+{
+    return sbox_chown_general(tcp, AT_FDCWD, 0);
+}
+
+int sbox_fchownat(struct tcb *tcp)
+{
+    return sbox_chown_general(tcp, tcp->u_arg[0], 1);
+}
+
+int sbox_fchown(struct tcb *tcp)
+{
+    // exiting and fakeroot enabled
+    if (opt_fakeroot && exiting(tcp) && tcp->regs.rax == -EPERM) {
+        dbg(fakeroot, "fchown(%ld) = 0", tcp->u_arg[0]);
+        sbox_rewrite_ret(tcp, 0);
+    }
+    return 0;
+}
+
+int sbox_prctl(struct tcb *tcp)
+{
+    // support nested seccomp
+    if (opt_seccomp \
+        && exiting(tcp) \
+        && tcp->u_arg[0] == PR_SET_SECCOMP \
+        && tcp->u_arg[1] == SECCOMP_MODE_STRICT \
+        && tcp->regs.rax != 0) {
+        dbg(seccomp, "prctl(SECCOMP, MODE_STRICT) = 0");
+        sbox_rewrite_ret(tcp, 0);
+    }
+    return 0;
+}
+
+DEF_SBOX_SC_PATH_AT(utimensat , 0, 1, WRITE);
+DEF_SBOX_SC_PATH_AT(readlinkat, 0, 1, READ );
+DEF_SBOX_SC_PATH_AT(fchmodat  , 0, 1, WRITE);
+DEF_SBOX_SC_PATH_AT(mknodat   , 0, 1, WRITE);
+DEF_SBOX_SC_PATH_AT(futimesat , 0, 1, WRITE);
+
+DEF_SBOX_SC_PATH(setxattr     , 0 , WRITE);
+DEF_SBOX_SC_PATH(lsetxattr    , 0 , WRITE);
+DEF_SBOX_SC_PATH(removexattr  , 0 , WRITE);
+DEF_SBOX_SC_PATH(lremovexattr , 0 , WRITE);
+DEF_SBOX_SC_PATH(getxattr     , 0 , READ );
+DEF_SBOX_SC_PATH(lgetxattr    , 0 , READ );
+DEF_SBOX_SC_PATH(listxattr    , 0 , READ );
+DEF_SBOX_SC_PATH(llistxattr   , 0 , READ );
+DEF_SBOX_SC_PATH(statfs       , 0 , READ );
+DEF_SBOX_SC_PATH(uselib       , 0 , READ );
+DEF_SBOX_SC_PATH(utimes       , 0 , WRITE);
+DEF_SBOX_SC_PATH(utime        , 0 , WRITE);
+DEF_SBOX_SC_PATH(chmod        , 0 , WRITE);
+DEF_SBOX_SC_PATH(execve       , 0 , READ );
+DEF_SBOX_SC_PATH(truncate     , 0 , FORCE);
+DEF_SBOX_SC_PATH(readlink     , 0 , READ );
+DEF_SBOX_SC_PATH(mknod        , 0 , WRITE);
+
+int sbox_not_allowed(struct tcb *tcp)
+{
+    sbox_stop(tcp, "%s is not allowed", sysent[tcp->scno].sys_name);
+    return 0;
+}
+
+/* interactive mode */
+static
+void _sbox_walk(const char *root, const char *name,
+                void (*handler)(char *spn, char *hpn, void *arg), void *arg)
+{
+    char pn[PATH_MAX];
+    if (name) {
+        snprintf(pn, sizeof(pn), "%s/%s", root, name);
+    } else {
+        strncpy(pn, root, sizeof(pn));
+    }
+
+    DIR *dir = opendir(pn);
+    if (!dir) {
+        warn("opendir %s", pn);
+        return;
+    }
+
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        const char *n = d->d_name;
+        int is_dir = d->d_type == DT_DIR;
+        char spn[PATH_MAX];
+        snprintf(spn, sizeof(spn), "%s/%s", pn, n);
+
+        // not every filesystem fills d_type in
+        if (d->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_dir = lstat(spn, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+
+        if (is_dir) {
+            if ((n[0] == '.' && n[1] == '\0') ||
+                (n[0] == '.' && n[1] == '.' && n[2] == '\0')) {
+                continue;
+            }
+            _sbox_walk(pn, n, handler, arg);
+        } else {
+            char hpn[PATH_MAX];
+            strncpy(hpn, spn + opt_root_len, sizeof(hpn));
+
+            if (handler) {
+                handler(spn, hpn, arg);
+            }
+        }
+    }
+
+    closedir(dir);
+}
+
+//
+// what the sandbox changed against the hostfs, from the change log
+// (see. sbox_log_change()) and the deleted files:
+// O(changes), the sandboxfs is only walked below the dirs written to
+// it (e.g., made or renamed in the sandbox)
+//
+#define CHANGE_NEW      'N'        /* not in the hostfs */
+#define CHANGE_MODIFIED 'M'        /* replaces the one in the hostfs */
+#define CHANGE_DELETED  'D'        /* deleted, with all below it */
+#define CHANGE_REPLACED 'R'        /* deleted, then made again as a dir */
+
+struct sbox_change {
+    char flag;
+    char *hpn;
+};
+
+struct sbox_changes {
+    struct sbox_change *list;
+    int len;
+    int size;
+    struct nameset seen;           /* hpns listed, and their names */
+};
+
+static
+void _sbox_add_change(struct sbox_changes *c, char flag, const char *hpn)
+{
+    size_t len = strlen(hpn);
+
+    if (has_name_in_set(&c->seen, hpn, len)) {
+        return;
+    }
+    add_name_to_set(&c->seen, hpn, len);
+
+    if (c->len == c->size) {
+        c->size = c->size ? c->size * 2 : 64;
+        c->list = realloc(c->list, c->size * sizeof(c->list[0]));
+        if (!c->list) {
+            die_out_of_memory();
+        }
+    }
+    c->list[c->len].flag = flag;
+    c->list[c->len].hpn = arena_strndup(&c->seen.arena, hpn, len);
+    c->len ++;
+}
+
+static
+void _sbox_list_file(char *spn, char *hpn, void *arg)
+{
+    struct stat st;
+    _sbox_add_change(arg, lstat(hpn, &st) == 0 ? CHANGE_MODIFIED : CHANGE_NEW, hpn);
+}
+
+static
+void _sbox_list_written(char *hpn, struct sbox_changes *c)
+{
+    char spn[PATH_MAX];
+    struct stat st;
+
+    snprintf(spn, sizeof(spn), "%s%s", opt_root, hpn);
+    if (lstat(spn, &st) < 0) {
+        return;
+    }
+    if (S_ISDIR(st.st_mode)) {
+        _sbox_walk(spn, NULL, _sbox_list_file, c);
+    } else {
+        _sbox_list_file(spn, hpn, c);
+    }
+}
+
+static
+void _sbox_list_deleted(const char *path, int val, void *arg)
+{
+    char spn[PATH_MAX];
+    struct stat st;
+
+    // nothing to delete in the hostfs
+    if (!(val & PATH_DELETED) || lstat(path, &st) < 0) {
+        return;
+    }
+
+    // made again in the sandboxfs: a file replaces it (CHANGE_MODIFIED),
+    // a dir is made empty, all below the hostfs one is gone
+    snprintf(spn, sizeof(spn), "%s%s", opt_root, path);
+    if (lstat(spn, &st) == 0) {
+        if (S_ISDIR(st.st_mode)) {
+            _sbox_add_change(arg, CHANGE_REPLACED, path);
+        }
+        return;
+    }
+    _sbox_add_change(arg, CHANGE_DELETED, path);
+}
+
+static
+int _sbox_cmp_change(const void *a, const void *b)
+{
+    return strcmp(((struct sbox_change *)a)->hpn, ((struct sbox_change *)b)->hpn);
+}
+
+static
+void sbox_list_changes(struct sbox_changes *c)
+{
+    struct nameentry *n, *ntmp;
+
+    memset(c, 0, sizeof(*c));
+
+    pthread_rwlock_rdlock(&os_deleted_fs_lock);
+    walk_fsmap(os_deleted_fs, _sbox_list_deleted, c);
+    pthread_rwlock_unlock(&os_deleted_fs_lock);
+
+    pthread_mutex_lock(&os_changes_lock);
+    HASH_ITER(hh, os_changes.entries, n, ntmp) {
+        _sbox_list_written(n->name, c);
+    }
+    pthread_mutex_unlock(&os_changes_lock);
+
+    qsort(c->list, c->len, sizeof(c->list[0]), _sbox_cmp_change);
+}
+
+static
+void sbox_free_changes(struct sbox_changes *c)
+{
+    free(c->list);
+    free_nameset(&c->seen);
+}
+
+static
+char _prompt(const char *menu)
+{
+    char c;
+    printf(" %s ?> ", menu);
+    c = kbhit();
+    printf("\n");
+    return c;
+}
+
+static
+int _sh_diff(char *a, char *b)
+{
+    int pid = fork();
+    if (!pid) {
+        execlp("diff", "diff", "-urN", a, b, NULL);
+        err(1, "diff");
+    }
+    waitpid(pid, NULL, 0);
+    return 0;
+}
+
+static
+int _sh_remove(char *hpn)
+{
+    printf("  > Removing %s\n", hpn);
+    int pid = fork();
+    if (!pid) {
+        execlp("rm", "rm", "-rf", "--", hpn, NULL);
+        err(1, "rm");
+    }
+    waitpid(pid, NULL, 0);
+    return 0;
+}
+
+static
+int _sh_commit(char *spn, char *hpn)
+{
+    char dir[PATH_MAX];
+    struct stat st;
+
+    printf("  > Commiting %s\n", hpn);
+
+    // made in the sandbox, or deleted before
+    snprintf(dir, sizeof(dir), "%s", hpn);
+    *strrchr(dir, '/') = '\0';
+    if (dir[0] && !path_exists(dir)) {
+        mkdirp(dir, 0755);
+    }
+    if (!copyfile(spn, hpn, NULL, NULL)) {
+        warnx("can't commit %s", spn);
+        return -1;
+    }
+
+    // along with its metadata, as changed in the sandbox
+    if (stat(spn, &st) == 0) {
+        struct timespec ts[2] = { st.st_atim, st.st_mtim };
+        chmod(hpn, st.st_mode & 07777);
+        utimensat(AT_FDCWD, hpn, ts, 0);
+    }
+    return 0;
+}
+
+static
+int _sh_mkdir(char *spn, char *hpn)
+{
+    struct stat st;
+
+    printf("  > Making %s\n", hpn);
+    if (stat(spn, &st) < 0 || mkdir(hpn, st.st_mode & 07777) < 0) {
+        warn("mkdir %s", hpn);
+        return -1;
+    }
+    return 0;
+}
+
+//
+// a change committed is in the hostfs now, so its records go (and
+// its file in the sandboxfs): it is not listed again, by this run or
+// the next one. the caller snapshots the maps once done.
+//
+static
+void sbox_forget_change(struct sbox_change *ch)
+{
+    char spn[PATH_MAX];
+    struct md5entry *s;
+
+    switch (ch->flag) {
+    case CHANGE_DELETED:
+    case CHANGE_REPLACED:
+        pthread_rwlock_wrlock(&os_deleted_fs_lock);
+        prune_fsmap(os_deleted_fs, ch->hpn);
+        add_path_to_fsmap(os_deleted_fs, ch->hpn, 0);
+        pthread_rwlock_unlock(&os_deleted_fs_lock);
+        break;
+    default:
+        snprintf(spn, sizeof(spn), "%s%s", opt_root, ch->hpn);
+        unlink(spn);
+
+        pthread_mutex_lock(&os_copyup_lock);
+        if ((s = get_md5_from_map(&os_md5map, ch->hpn))) {
+            HASH_DEL(os_md5map.entries, s);
         }
+        pthread_mutex_unlock(&os_copyup_lock);
+
+        pthread_mutex_lock(&os_changes_lock);
+        del_name_from_set(&os_changes, ch->hpn, strlen(ch->hpn));
+        pthread_mutex_unlock(&os_changes_lock);
     }
-    return 0;
 }
 
-int sbox_chown(struct tcb *tcp)
+static
+void _sh_commit_change(struct sbox_change *ch)
 {
-    return sbox_chown_general(tcp, AT_FDCWD, 0);
+    char spn[PATH_MAX];
+    int ret;
+
+    snprintf(spn, sizeof(spn), "%s%s", opt_root, ch->hpn);
+    switch (ch->flag) {
+    case CHANGE_DELETED:
+        ret = _sh_remove(ch->hpn);
+        break;
+    case CHANGE_REPLACED:
+        ret = _sh_remove(ch->hpn) || _sh_mkdir(spn, ch->hpn);
+        break;
+    default:
+        ret = _sh_commit(spn, ch->hpn);
+    }
+    if (ret == 0) {
+        sbox_forget_change(ch);
+    }
 }
 
-int sbox_lchown(struct tcb *tcp)
+//
+// a batch commit of the changes (-a, or [C]ommit all): all or nothing,
+// as far as the filesystems let it. the files are staged first, by a
+// pool of workers, in the dir each goes to (or the first one up in the
+// hostfs, and not replaced): moved from the sandboxfs if on the same
+// filesystem, or else copied (sharing the blocks, or in the kernel,
+// see. copyfile()). then, in one pass, what each one replaces or
+// deletes is put aside, and the staged one renamed to its place; a
+// failure on the way puts all back as it was. what was put aside is
+// removed last.
+//
+#define COMMIT_WORKERS_MAX 16
+
+#define COMMIT_MOVED   (1<<0)      /* staged, renamed from the spn */
+#define COMMIT_COPIED  (1<<1)      /* staged, a copy of the spn */
+#define COMMIT_ASIDE   (1<<2)      /* the hpn kept aside, until done */
+#define COMMIT_PLACED  (1<<3)      /* the staged one renamed to the hpn */
+#define COMMIT_MKDIR   (1<<4)      /* its dir made, from made[] on */
+
+struct sbox_commit {
+    struct sbox_change *list;
+    int *state;                    /* COMMIT_*, of each change */
+    int *dirlen;                   /* of the dir each is staged in */
+    int *made;                     /* of the first dir mkdirp() made */
+    int len;
+    int next;                      /* to stage, by the workers */
+    int failed;
+    pthread_mutex_t lock;
+};
+
+/* where the change i is staged ("new") or its hpn kept ("old") */
+static
+void _sbox_commit_tmp(const char *hpn, int dirlen, const char *what, int i,
+                      char *tmp)
 {
-    return sbox_chown_general(tcp, AT_FDCWD, 0);
+    snprintf(tmp, PATH_MAX, "%.*s/.mbox-%s.%d.%d", dirlen, hpn, what, getpid(), i);
 }
 
-int sbox_fchownat(struct tcb *tcp)
+#define _sbox_commit_new(c, i, tmp)                                     \
+    _sbox_commit_tmp((c)->list[i].hpn, (c)->dirlen[i], "new", i, tmp)
+#define _sbox_commit_old(c, i, tmp)                                     \
+    _sbox_commit_tmp((c)->list[i].hpn,                                  \
+                     strrchr((c)->list[i].hpn, '/') - (c)->list[i].hpn, \
+                     "old", i, tmp)
+
+/* a dir of the hostfs put aside and made again, at its place */
+static
+int _sbox_commit_replaced(struct sbox_commit *c, const char *dir)
 {
-    return sbox_chown_general(tcp, tcp->u_arg[0], 1);
+    struct sbox_change key = { .hpn = (char *)dir };
+    struct sbox_change *ch;
+
+    ch = bsearch(&key, c->list, c->len, sizeof(key), _sbox_cmp_change);
+    return ch && ch->flag == CHANGE_REPLACED;
 }
 
-int sbox_fchown(struct tcb *tcp)
+/* the first dir up from the change i that stays in the hostfs */
+static
+int _sbox_commit_dirlen(struct sbox_commit *c, int i)
 {
-    // exiting and fakeroot enabled
-    if (opt_fakeroot && exiting(tcp) && tcp->regs.rax == -EPERM) {
-        dbg(fakeroot, "fchown(%ld) = 0", tcp->u_arg[0]);
-        sbox_rewrite_ret(tcp, 0);
+    const char *hpn = c->list[i].hpn;
+    char dir[PATH_MAX];
+    struct stat st;
+    int len = strrchr(hpn, '/') - hpn;
+
+    while (len > 0) {
+        snprintf(dir, sizeof(dir), "%.*s", len, hpn);
+        if (lstat(dir, &st) == 0 && S_ISDIR(st.st_mode)
+            && !_sbox_commit_replaced(c, dir)) {
+            break;
+        }
+        len = strrchr(dir, '/') - dir;
     }
-    return 0;
+    return len;
 }
 
-int sbox_prctl(struct tcb *tcp)
+static
+int _sbox_commit_stage(struct sbox_commit *c, int i)
 {
-    // support nested seccomp
-    if (opt_seccomp \
-        && exiting(tcp) \
-        && tcp->u_arg[0] == PR_SET_SECCOMP \
-        && tcp->u_arg[1] == SECCOMP_MODE_STRICT \
-        && tcp->regs.rax != 0) {
-        dbg(seccomp, "prctl(SECCOMP, MODE_STRICT) = 0");
-        sbox_rewrite_ret(tcp, 0);
+    struct sbox_change *ch = &c->list[i];
+    char spn[PATH_MAX];
+    char tmp[PATH_MAX];
+    struct stat st;
+
+    if (ch->flag != CHANGE_NEW && ch->flag != CHANGE_MODIFIED) {
+        return 1;
+    }
+    snprintf(spn, sizeof(spn), "%s%s", opt_root, ch->hpn);
+    if (lstat(spn, &st) < 0) {
+        warn("stat %s", spn);
+        return 0;
     }
-    return 0;
-}
 
-DEF_SBOX_SC_PATH_AT(utimensat , 0, 1, WRITE);
-DEF_SBOX_SC_PATH_AT(readlinkat, 0, 1, READ );
-DEF_SBOX_SC_PATH_AT(fchmodat  , 0, 1, WRITE);
-DEF_SBOX_SC_PATH_AT(mknodat   , 0, 1, WRITE);
-DEF_SBOX_SC_PATH_AT(futimesat , 0, 1, WRITE);
+    _sbox_commit_new(c, i, tmp);
 
-DEF_SBOX_SC_PATH(setxattr     , 0 , WRITE);
-DEF_SBOX_SC_PATH(lsetxattr    , 0 , WRITE);
-DEF_SBOX_SC_PATH(removexattr  , 0 , WRITE);
-DEF_SBOX_SC_PATH(lremovexattr , 0 , WRITE);
-DEF_SBOX_SC_PATH(getxattr     , 0 , READ );
-DEF_SBOX_SC_PATH(lgetxattr    , 0 , READ );
-DEF_SBOX_SC_PATH(listxattr    , 0 , READ );
-DEF_SBOX_SC_PATH(llistxattr   , 0 , READ );
-DEF_SBOX_SC_PATH(statfs       , 0 , READ );
-DEF_SBOX_SC_PATH(uselib       , 0 , READ );
-DEF_SBOX_SC_PATH(utimes       , 0 , WRITE);
-DEF_SBOX_SC_PATH(utime        , 0 , WRITE);
-DEF_SBOX_SC_PATH(chmod        , 0 , WRITE);
-DEF_SBOX_SC_PATH(execve       , 0 , READ );
-DEF_SBOX_SC_PATH(truncate     , 0 , FORCE);
-DEF_SBOX_SC_PATH(readlink     , 0 , READ );
-DEF_SBOX_SC_PATH(mknod        , 0 , WRITE);
+    // its target was rewritten to the sandboxfs (see. sbox_symlinkat())
+    if (S_ISLNK(st.st_mode)) {
+        char link[PATH_MAX];
+        ssize_t len = readlink(spn, link, sizeof(link) - 1);
+        if (len >= 0) {
+            link[len] = '\0';
+        }
+        if (len < 0 || symlink(is_in_sboxfs(link) ? link + opt_root_len : link,
+                               tmp) < 0) {
+            warn("symlink %s", tmp);
+            return 0;
+        }
+        c->state[i] = COMMIT_COPIED;
+        return 1;
+    }
 
-int sbox_not_allowed(struct tcb *tcp)
-{
-    sbox_stop(tcp, "%s is not allowed", sysent[tcp->scno].sys_name);
-    return 0;
+    if (rename(spn, tmp) == 0) {
+        c->state[i] = COMMIT_MOVED;
+        return 1;
+    }
+    if (errno != EXDEV) {
+        warn("rename %s", spn);
+        return 0;
+    }
+
+    // another filesystem, so copied (sharing the blocks if it can)
+    if (!S_ISREG(st.st_mode) || !copyfile(spn, tmp, NULL, NULL)) {
+        unlink(tmp);
+        warnx("can't commit %s", spn);
+        return 0;
+    }
+    struct timespec ts[2] = { st.st_atim, st.st_mtim };
+    chmod(tmp, st.st_mode & 07777);
+    utimensat(AT_FDCWD, tmp, ts, 0);
+    c->state[i] = COMMIT_COPIED;
+    return 1;
 }
 
-/* interactive mode */
 static
-void _sbox_walk(const char *root, const char *name,
-                int (*handler)(char *spn, char *hpn))
+void *_sbox_commit_worker(void *arg)
 {
-    char pn[PATH_MAX];
-    if (name) {
-        snprintf(pn, sizeof(pn), "%s/%s", root, name);
-    } else {
-        strncpy(pn, root, sizeof(pn));
-    }
+    struct sbox_commit *c = arg;
+    int i;
 
-    DIR *dir = opendir(pn);
-    if (!dir) {
-        err(1, "opendir");
+    for (;;) {
+        pthread_mutex_lock(&c->lock);
+        i = c->failed ? c->len : c->next ++;
+        pthread_mutex_unlock(&c->lock);
+        if (i >= c->len) {
+            break;
+        }
+        if (!_sbox_commit_stage(c, i)) {
+            pthread_mutex_lock(&c->lock);
+            c->failed = 1;
+            pthread_mutex_unlock(&c->lock);
+        }
     }
+    return NULL;
+}
 
-    struct dirent *d;
-    while ((d = readdir(dir)) != NULL) {
-        const char *n = d->d_name;
-        if (d->d_type & DT_DIR) {
-            if ((n[0] == '.' && n[1] == '\0') ||
-                (n[0] == '.' && n[1] == '.' && n[2] == '\0')) {
-                continue;
-            }
-            _sbox_walk(pn, n, handler);
+static
+int _sbox_commit_place(struct sbox_commit *c, int i)
+{
+    struct sbox_change *ch = &c->list[i];
+    int replaces = ch->flag == CHANGE_NEW || ch->flag == CHANGE_MODIFIED;
+    char spn[PATH_MAX];
+    char tmp[PATH_MAX];
+    char old[PATH_MAX];
+    char dir[PATH_MAX];
+    struct stat st;
+
+    // a file stays in place (a link aside) until replaced, a dir or
+    // what is deleted goes aside now
+    _sbox_commit_old(c, i, old);
+    if (lstat(ch->hpn, &st) == 0) {
+        if ((replaces && !S_ISDIR(st.st_mode) && link(ch->hpn, old) == 0)
+            || rename(ch->hpn, old) == 0) {
+            c->state[i] |= COMMIT_ASIDE;
         } else {
-            char spn[PATH_MAX];
-            char hpn[PATH_MAX];
-            snprintf(spn, sizeof(spn), "%s/%s", pn, n);
-            strncpy(hpn, spn + opt_root_len, sizeof(hpn));
+            warn("rename %s", ch->hpn);
+            return 0;
+        }
+    }
+    if (ch->flag == CHANGE_DELETED) {
+        return 1;
+    }
 
-            if (handler) {
-                handler(spn, hpn);
+    // made again, empty: what goes below it is placed next
+    snprintf(spn, sizeof(spn), "%s%s", opt_root, ch->hpn);
+    if (ch->flag == CHANGE_REPLACED) {
+        if (stat(spn, &st) < 0 || mkdir(ch->hpn, st.st_mode & 07777) < 0) {
+            warn("mkdir %s", ch->hpn);
+            return 0;
+        }
+        c->state[i] |= COMMIT_PLACED;
+        return 1;
+    }
+
+    // made in the sandbox, or deleted (or replaced) before: the first
+    // one missing up is removed again on undo
+    snprintf(dir, sizeof(dir), "%s", ch->hpn);
+    *strrchr(dir, '/') = '\0';
+    if (dir[0] && !path_exists(dir)) {
+        char up[PATH_MAX];
+        char *slash;
+
+        snprintf(up, sizeof(up), "%s", dir);
+        c->made[i] = strlen(up);
+        while ((slash = strrchr(up, '/')) && slash != up) {
+            *slash = '\0';
+            if (path_exists(up)) {
+                break;
             }
+            c->made[i] = slash - up;
+        }
+        c->state[i] |= COMMIT_MKDIR;
+        if (!mkdirp(dir, 0755)) {
+            warn("mkdir %s", dir);
+            return 0;
         }
     }
 
-    closedir(dir);
+    _sbox_commit_new(c, i, tmp);
+    if (rename(tmp, ch->hpn) < 0) {
+        warn("rename %s", ch->hpn);
+        return 0;
+    }
+    c->state[i] |= COMMIT_PLACED;
+    return 1;
 }
 
+/* put back the change i, as before the commit */
 static
-char _prompt(const char *menu)
+void _sbox_commit_undo(struct sbox_commit *c, int i)
 {
-    char c;
-    printf(" %s ?> ", menu);
-    c = kbhit();
-    printf("\n");
-    return c;
+    struct sbox_change *ch = &c->list[i];
+    char spn[PATH_MAX];
+    char tmp[PATH_MAX];
+    char old[PATH_MAX];
+    char dir[PATH_MAX];
+
+    _sbox_commit_new(c, i, tmp);
+    _sbox_commit_old(c, i, old);
+
+    if (c->state[i] & COMMIT_PLACED) {
+        if (ch->flag == CHANGE_REPLACED) {
+            rmdir(ch->hpn);
+        } else {
+            rename(ch->hpn, tmp);
+        }
+    }
+    if (c->state[i] & COMMIT_ASIDE) {
+        // a link of the same file is left as is by rename()
+        rename(old, ch->hpn);
+        unlink(old);
+    }
+    if (c->state[i] & COMMIT_MOVED) {
+        snprintf(spn, sizeof(spn), "%s%s", opt_root, ch->hpn);
+        rename(tmp, spn);
+    } else if (c->state[i] & COMMIT_COPIED) {
+        unlink(tmp);
+    }
+    if (c->state[i] & COMMIT_MKDIR) {
+        // empty again, what was placed below is undone before
+        snprintf(dir, sizeof(dir), "%s", ch->hpn);
+        *strrchr(dir, '/') = '\0';
+        while ((int)strlen(dir) >= c->made[i]) {
+            rmdir(dir);
+            *strrchr(dir, '/') = '\0';
+        }
+    }
+    c->state[i] = 0;
 }
 
 static
-int _sh_diff(char *a, char *b)
+int _sbox_purge_entry(const char *path, const struct stat *sb, int type, struct FTW *ftw)
 {
-    int pid = fork();
-    if (!pid) {
-        execlp("diff", "diff", "-urN", a, b, NULL);
-        err(1, "diff");
+    if (remove(path) < 0) {
+        warn("remove %s", path);
     }
-    waitpid(pid, NULL, 0);
     return 0;
 }
 
 static
-int _sh_commit(char *spn, char *hpn)
-{
-    printf("  > Commiting %s\n", hpn);
-    copyfile(spn, hpn, NULL);
-    return 0;
-}
+int sbox_commit_changes(struct sbox_change *list, int len)
+{
+    struct sbox_commit c = { .list = list, .len = len };
+    pthread_t workers[COMMIT_WORKERS_MAX];
+    struct timespec beg, end;
+    char old[PATH_MAX];
+    int moved = 0, copied = 0, deleted = 0;
+    int nworkers, n, i;
+
+    if (len == 0) {
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &beg);
+    c.state = calloc(len, sizeof(c.state[0]));
+    c.dirlen = calloc(len, sizeof(c.dirlen[0]));
+    c.made = calloc(len, sizeof(c.made[0]));
+    if (!c.state || !c.dirlen || !c.made) {
+        die_out_of_memory();
+    }
+    for (i = 0; i < len; i ++) {
+        c.dirlen[i] = _sbox_commit_dirlen(&c, i);
+    }
+    pthread_mutex_init(&c.lock, NULL);
+
+    nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+    nworkers = min(min(nworkers, COMMIT_WORKERS_MAX), len);
+    for (n = 0; n < nworkers; n ++) {
+        if (pthread_create(&workers[n], NULL, _sbox_commit_worker, &c)) {
+            break;
+        }
+    }
+    if (n == 0) {
+        _sbox_commit_worker(&c);
+    }
+    for (i = 0; i < n; i ++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    // all staged, then all in place, or nothing
+    if (!c.failed) {
+        for (i = 0; i < len && _sbox_commit_place(&c, i); i ++);
+        c.failed = i < len;
+    }
+    if (c.failed) {
+        for (i = len - 1; i >= 0; i --) {
+            _sbox_commit_undo(&c, i);
+        }
+        free(c.state);
+        free(c.dirlen);
+        free(c.made);
+        warnx("Commit failed, nothing committed");
+        return 0;
+    }
 
+    for (i = 0; i < len; i ++) {
+        if (c.state[i] & COMMIT_ASIDE) {
+            _sbox_commit_old(&c, i, old);
+            nftw(old, _sbox_purge_entry, 64, FTW_DEPTH | FTW_PHYS);
+        }
+        deleted += list[i].flag == CHANGE_DELETED
+            || list[i].flag == CHANGE_REPLACED;
+        moved += !!(c.state[i] & COMMIT_MOVED);
+        copied += !!(c.state[i] & COMMIT_COPIED);
+        sbox_forget_change(&list[i]);
+    }
+    free(c.state);
+    free(c.dirlen);
+    free(c.made);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    fprintf(stderr, "Commit: %d files (%d moved, %d copied), %d deleted "
+            "in %.3f sec (%d workers)\n", moved + copied, moved, copied,
+            deleted, (end.tv_sec - beg.tv_sec)
+            + (end.tv_nsec - beg.tv_nsec) / 1e9, n ? n : 1);
+    return 1;
+}
 
-static
-int _sbox_print_file(char *spn, char *hpn)
+/* commit all the changes at once, without asking (-a) */
+int sbox_commit(void)
 {
-    printf(" > F: %s\n", spn);
-    return 0;
+    struct sbox_changes c;
+    int ret;
+
+    sbox_list_changes(&c);
+    ret = sbox_commit_changes(c.list, c.len);
+    sbox_free_changes(&c);
+
+    // what is committed is not replayed by the next run
+    if (ret && c.len) {
+        sbox_snapshot_meta(1, 0);
+    }
+    return ret;
 }
 
 static
-void _sbox_dump_sboxfs(void)
+void _sbox_dump_sboxfs(struct sbox_changes *c)
 {
+    int i;
+
     printf("Sandbox Root:\n > %s\n", opt_root);
-    _sbox_walk(opt_root, NULL, _sbox_print_file);
+    for (i = 0; i < c->len; i ++) {
+        printf(" > %c: %s\n", c->list[i].flag, c->list[i].hpn);
+    }
 }
 
+/* 1 once done: the changes from i on committed, or quit */
 static
-int _sbox_interactive_menu(char *spn, char *hpn)
+int _sbox_interactive_menu(struct sbox_changes *c, int i)
 {
-    static int opt_commit_all = 0;
+    struct sbox_change *ch = &c->list[i];
+    char spn[PATH_MAX];
 
     const char *menu \
         = "[C]ommit all, [c]ommit, [i]gnore, [d]iff, [l]ist tree, [q]uit";
 
-    if (opt_commit_all) {
-        _sh_commit(spn, hpn);
-        return 0;
-    }
-
+    snprintf(spn, sizeof(spn), "%s%s", opt_root, ch->hpn);
     while (1) {
-        // TODO. append insteresting flag instead of 'F'
-        // N: new file
-        // M: modified file
-        // D: deleted file
-        printf("F:%s\n", hpn);
+        // N: new file, M: modified file, D: deleted file,
+        // R: deleted, then made again as a dir
+        printf("%c:%s\n", ch->flag, ch->hpn);
         switch (_prompt(menu)) {
         case 'C':
-            /* XXX. locked all files and commit at the same time */
-            opt_commit_all = 1;
-            /* fall-in */
+            // this one and the rest, in a batch
+            sbox_commit_changes(ch, c->len - i);
+            return 1;
         case 'c':
-            _sh_commit(spn, hpn);
+            _sh_commit_change(ch);
             /* fall-in */
         case 'i':
             return 0;
             break;
         case 'd':
-            _sh_diff(spn, hpn);
+            _sh_diff(spn, ch->hpn);
             break;
         case 'l':
-            _sbox_dump_sboxfs();
+            _sbox_dump_sboxfs(c);
             break;
         case 'q':
-            exit(0);
-            break;
+            return 1;
         }
     }
     return 0;
@@ -1402,90 +3782,99 @@ int _sbox_interactive_menu(char *spn, char *hpn)
 
 int sbox_interactive(void)
 {
-    _sbox_dump_sboxfs();
-    _sbox_walk(opt_root, NULL, _sbox_interactive_menu);
+    struct sbox_changes c;
+    int i;
 
-    // XXX. need to walk over deleted files too
+    sbox_list_changes(&c);
+    _sbox_dump_sboxfs(&c);
+    for (i = 0; i < c.len; i ++) {
+        if (_sbox_interactive_menu(&c, i)) {
+            break;
+        }
+    }
+    sbox_free_changes(&c);
 
+    if (c.len) {
+        sbox_snapshot_meta(1, 0);
+    }
     return 0;
 }
 
 /* stop on restricted activities */
-void sbox_stop(struct tcb *tcp, const char *fmt, ...)
+//
+// nothing may change the sandbox while it is cleaned up: the main
+// thread stops the notification workers (-u) before anything else
+//
+static
+void sbox_stop_all(struct tcb *tcp)
 {
-    va_list args;
-
-    fprintf(stderr, "\nStop executing pid=%d: ", tcp->pid);
-
-    va_start(args, fmt);
-    vfprintf(stderr, fmt, args);
-    va_end(args);
-
-    fprintf(stderr, "\n");
-    fflush(stderr);
+    if (opt_notify) {
+        sbox_notify_stop();
+    }
 
     kill_all(tcp);
 
-    // clean up & info to user
+    // clean up & info to user; nothing is committed without asking
+    // (-a) if stopped half way
     sbox_cleanup();
-    if (opt_interactive) {
+    if (opt_commit) {
+        warnx("Stopped, nothing committed");
+    } else if (opt_interactive) {
         sbox_interactive();
     }
 
     exit(0);
 }
 
-/* fetch readlony memory address */
-void sbox_get_readonly_ptr(struct tcb *tcp)
+void sbox_stop(struct tcb *tcp, const char *fmt, ...)
 {
-    char proc[256];
-    snprintf(proc, sizeof(proc), "/proc/%d/maps", tcp->pid);
+    va_list args;
 
-    FILE *fp = fopen(proc, "r");
-    if (!fp) {
-        err(1, "fopen");
-    }
+    fprintf(stderr, "\nStop executing pid=%d: ", tcp->pid);
 
-    long ptr = -1;
-    size_t len = 0;
-    char *line = NULL;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
 
-    while (getline(&line, &len, fp) != -1) {
-        // find the very first non-writable area
-        if (strstr(line, "r-xp")) {
-            // mem ptr upto '-'
-            char *del = strstr(line, "-");
-            if (del) {
-                sscanf(line, "%lx-", &ptr);
-                break;
-            }
-        }
-    }
-    fclose(fp);
+    fprintf(stderr, "\n");
+    fflush(stderr);
 
-    if (line) {
-        free(line);
+    // a worker can neither join the others nor stop the ptrace engine:
+    // it leaves the tracee unanswered, and its death wakes up the main
+    // thread to stop (see. sbox_check_stop())
+    if (tcp->flags & TCB_NOTIFY) {
+        __sync_bool_compare_and_swap(&os_stop_pid, 0, tcp->pid);
+        kill(tcp->pid, SIGKILL);
+        pthread_exit(NULL);
     }
 
-    // can't find one, just use $rsp
-    if (ptr == -1) {
-        dbg(info, "Can't find the readonly ptr, use $rsp");
-    } else {
-        dbg(info, "Found readonly memory: 0x%lx", ptr);
+    sbox_stop_all(tcp);
+}
+
+/* on the main thread: stop if a notification worker asked for it */
+void sbox_check_stop(void)
+{
+    if (os_stop_pid) {
+        sbox_stop_all(NULL);
     }
+}
 
-    // verify if it is writable on debug
-    if (debug_flag) {
-        int dummy = 0xdeadbeef;
-        sbox_remote_write(tcp, ptr, (char *)&dummy, 4);
+/* pass logs of the tcb to the systemlog */
+void sbox_flush_logs(struct tcb *tcp)
+{
+    if (tcp->logs) {
+        struct systemlog *log = \
+            (struct systemlog *) safe_malloc(sizeof(struct systemlog));
+        log->pid = tcp->pid;
+        log->logs = tcp->logs;
 
-        long read = ptrace(PTRACE_PEEKDATA, tcp->pid, (char *)ptr, 0);
-        if (read != dummy) {
-            dbg(info, "0x%lx is not writable", ptr);
-        }
+        // bump
+        pthread_mutex_lock(&os_systemlog_lock);
+        log->next = systemlog;
+        systemlog = log;
+        pthread_mutex_unlock(&os_systemlog_lock);
+        tcp->logs = NULL;
     }
-
-    tcp->readonly_ptr = ptr;
 }
 
 void sbox_add_log(struct tcb *tcp, const char *fmt, ...)
@@ -1589,6 +3978,7 @@ void sbox_load_profile(char *profile)
                 char sboxpath[PATH_MAX];
                 snprintf(sboxpath, sizeof(sboxpath), "%s/%s", opt_root, path);
                 mkdirp(sboxpath, 0755);
+                sbox_index_spn(sboxpath, INDEX_OPAQUE);
 
                 if (path) {
                     free(path);
@@ -1607,31 +3997,16 @@ void sbox_load_profile(char *profile)
     fclose(fp);
 }
 
-int sbox_mprotect(struct tcb *tcp)
-{
-    // for mprotect(WRITE)
-    if (entering(tcp) && (tcp->u_arg[2] & PROT_WRITE)) {
-        // make sure if others in the 'entry' state
-        if (has_any_entering_proc(tcp)) {
-            sbox_stop(tcp, "Should wait until other syscalls to be done");
-        }
-    }
-    return 0;
-}
-
-/* specifically the first argument for address, sencod argument for the size */
+/* the scratch of hijacked paths must stay mapped and read-only */
 static
-void _check_memory_region(struct tcb *tcp)
+void _check_memory_region(struct tcb *tcp, unsigned long beg, unsigned long len)
 {
-    unsigned long beg = tcp->u_arg[0];
-    unsigned long end = beg + tcp->u_arg[1];
-    unsigned long ptr = (unsigned long) tcp->readonly_ptr;
+    unsigned long ptr = (unsigned long) tcp->mm->scratch;
+
+    if (tcp->mm->scratch != -1
+        && beg < ptr + SCRATCH_SIZE
+        && ptr < beg + len) {
 
-    if (tcp->readonly_ptr != -1
-        && beg < end
-        && beg < ptr
-        && ptr < end) {
-        
         char *sname = "";
         if (SCNO_IN_RANGE(tcp->scno)) {
             sname = sysent[tcp->scno].sys_name;
@@ -1641,33 +4016,39 @@ void _check_memory_region(struct tcb *tcp)
     }
 }
 
-int sbox_mmap(struct tcb *tcp)
+int sbox_mprotect(struct tcb *tcp)
 {
     if (entering(tcp)) {
-        _check_memory_region(tcp);
+        _check_memory_region(tcp, tcp->u_arg[0], tcp->u_arg[1]);
     }
     return 0;
 }
 
-int sbox_mremap(struct tcb *tcp)
+int sbox_munmap(struct tcb *tcp)
 {
+    // its address could be mapped again, writable. under -s, only
+    // stopped at if the scratch can't be sealed (sbox_relax_filter())
     if (entering(tcp)) {
-        _check_memory_region(tcp);
+        _check_memory_region(tcp, tcp->u_arg[0], tcp->u_arg[1]);
+    }
+    return 0;
+}
+
+int sbox_mmap(struct tcb *tcp)
+{
+    // otherwise, the kernel doesn't replace an existing mapping
+    if (entering(tcp) && (tcp->u_arg[3] & MAP_FIXED)) {
+        _check_memory_region(tcp, tcp->u_arg[0], tcp->u_arg[1]);
     }
     return 0;
 }
 
-int sbox_brk(struct tcb *tcp)
+int sbox_mremap(struct tcb *tcp)
 {
-    if (exiting(tcp)) {
-        unsigned long arg = tcp->u_arg[0];
-        unsigned long new = tcp->u_rval;
-        unsigned long ptr = (unsigned long)tcp->readonly_ptr;
-
-        if (arg != 0
-            && tcp->readonly_ptr != -1
-            && new < ptr) {
-            sbox_stop(tcp, "brk() is not allowed if targetting the arg ptr");
+    if (entering(tcp)) {
+        _check_memory_region(tcp, tcp->u_arg[0], tcp->u_arg[1]);
+        if (tcp->u_arg[3] & MREMAP_FIXED) {
+            _check_memory_region(tcp, tcp->u_arg[4], tcp->u_arg[2]);
         }
     }
     return 0;
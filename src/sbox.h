@@ -4,23 +4,146 @@
 #define READWRITE_WRITE   1
 #define READWRITE_FORCE   2
 
+//
+// hijacked paths are written to a read-only mapping injected into
+// each address space before its first hijack (and sealed if the
+// kernel can), so other threads of the tracee can't modify them
+// between our check and the kernel's use. a thread in a hijacked
+// syscall owns one slot, big enough for two full paths.
+//
+#define SCRATCH_SLOT_SIZE (2 * PATH_MAX)
+#define SCRATCH_SLOTS     64
+#define SCRATCH_SIZE      (SCRATCH_SLOT_SIZE * SCRATCH_SLOTS)
+
+#define SLOT_NONE         -1      /* no string hijacked */
+
+struct sbox_mm {
+    int refcnt;                    /* tcbs sharing the address space */
+    long scratch;                  /* scratch mapping, or -1 */
+    int sealed;                    /* mseal() of the scratch is done */
+    int injecting;                 /* a thread is mapping the scratch */
+    int inject_failed;             /* mmap() or mseal() of it failed */
+    int memfd;                     /* /proc/pid/mem, or -1 */
+    unsigned long long busy;       /* slots in use */
+    char *slot_data[SCRATCH_SLOTS];/* what each slot holds now */
+    int slot_len[SCRATCH_SLOTS];
+};
+
 static inline
 int path_exists(char *path)
 {
     return access(path, F_OK) == 0;
 }
 
+//
+// cwd of a process, shared by CLONE_FS threads. refilled from
+// /proc/pid/cwd after chdir()/fchdir(), or once a directory was
+// renamed or removed (os_dirs_gen).
+//
+struct sbox_fs {
+    int refcnt;                    /* tcbs sharing the cwd */
+    int valid;                     /* cwd[] is up-to-date */
+    int used;                      /* filled or changed since created */
+    unsigned int gen;              /* os_dirs_gen when filled */
+    int in_sbox;                   /* cwd is under the sboxfs */
+    int len;
+    char cwd[PATH_MAX];            /* hpn of the cwd */
+};
+
+//
+// paths of the open dirs of a process as /proc/pid/fd/# reads them,
+// shared by CLONE_FILES threads. an fd is read from /proc once, and
+// forgotten once closed or replaced (close, close_range, dup2, dup3
+// and execve), or, under -s, which doesn't stop at these, once found
+// to be another file (see. sbox_fd_valid()).
+//
+struct sbox_dents;
+
+/* d_off of the hostfs records of a merged listing, and their count */
+#define SBOX_DENTS_OFF    (1LL << 62)
+
+struct sbox_fdent {
+    char *path;                    /* NULL if unknown */
+    int len;
+    unsigned int gen;              /* os_dirs_gen when read */
+    int copy;                      /* of the fd, to tell it is the same */
+    struct sbox_dents *dents;      /* hostfs listing merged, or NULL */
+};
+
+struct sbox_files {
+    int refcnt;                    /* tcbs sharing the fd table */
+    int used;                      /* looked up or changed since created */
+    pid_t pid;                     /* a tracee using it, to check copies */
+    int nfds;                      /* size of fds[] */
+    struct sbox_fdent *fds;
+    struct sbox_files *prev, *next;/* all the fd tables */
+};
+
+/* copies of the tracees' fds kept open at most, if the rlimit allows */
+#define SBOX_FD_COPIES    1024
+
+//
+// a path of the tracee (hpn), built right after a copy of opt_root:
+// from the start of the same buffer, it is the path in the sandboxfs
+// (spn). the length is kept along, so going from one to the other
+// copies nothing.
+//
+struct sbox_path {
+    int len;                       /* of the hpn */
+    char buf[2 * PATH_MAX];        /* opt_root, then the hpn */
+};
+
+#define sbox_hpn(p)     ((p)->buf + opt_root_len)
+#define sbox_spn(p)     ((p)->buf)
+#define sbox_spn_len(p) (opt_root_len + (p)->len)
+
+//
+// the path arg a syscall resolved at its entry, reused by its exit
+// (and by a second look at the entry) as is. resolving it again after
+// the syscall ran is not only slower: the cwd or a dir may have moved.
+//
+#define CALL_REWRITTEN    (1<<0)  /* the path was hijacked to the spn */
+#define CALL_MOVES_DIR    (1<<1)  /* rename() of a dir, at the exit if done */
+
+struct sbox_call {
+    int arg;                       /* path arg resolved, or -1 */
+    int ret;                       /* of resolving it, -1 if no path */
+    int err;                       /* errno, if no path */
+    int flags;                     /* CALL_* decided at entry */
+    struct sbox_path path;
+};
+
 extern void sbox_remote_write(struct tcb *tcp, long ptr, char *buf, int len);
 extern void sbox_rewrite_arg(struct tcb *tcp, int arg, long val);
-extern void sbox_hijack_str(struct tcb *tcp, int arg, char *new);
+extern void sbox_flush_regs(struct tcb *tcp);
+extern void sbox_hijack_str(struct tcb *tcp, int arg, char *new, int len);
 extern void sbox_restore_hijack(struct tcb *tcp);
 extern void sbox_check_test_cond(const char *pn, const char *key);
 extern void sbox_init(void);
 extern void sbox_cleanup(void);
 extern int sbox_interactive(void);
+extern int sbox_commit(void);
 extern void sbox_stop(struct tcb *tcp, const char *fmt, ...);
-extern void sbox_get_readonly_ptr(struct tcb *tcp);
+extern void sbox_check_stop(void);
+extern struct sbox_mm *sbox_new_mm(void);
+extern void sbox_put_mm(struct tcb *tcp);
+extern void sbox_inherit_mm(struct tcb *child, struct tcb *parent, int shared);
+extern struct sbox_fs *sbox_new_fs(void);
+extern void sbox_put_fs(struct tcb *tcp);
+extern void sbox_inherit_fs(struct tcb *child, struct tcb *parent, int shared);
+extern struct sbox_files *sbox_new_files(void);
+extern void sbox_put_files(struct tcb *tcp);
+extern void sbox_put_pidfd(struct tcb *tcp);
+extern void sbox_raise_nofile(void);
+extern void sbox_inherit_files(struct tcb *child, struct tcb *parent, int shared);
+extern void sbox_flush_stage(struct tcb *tcp);
+extern int sbox_inject_enter(struct tcb *tcp);
+extern int sbox_inject_stop(struct tcb *tcp);
+struct sock_filter;
+extern void sbox_relax_filter(struct sock_filter *filter, int len);
 extern void sbox_add_log(struct tcb *tcp, const char *fmt, ...);
+extern void sbox_flush_logs(struct tcb *tcp);
+extern void sbox_free_call(struct tcb *tcp);
 extern void sbox_load_profile(char *profile);
 
 #define is_in_sboxfs(pn) (strncmp(pn, opt_root, opt_root_len) == 0)
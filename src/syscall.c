@@ -35,6 +35,7 @@
 #include "sbox.h"
 #include <sys/user.h>
 #include <sys/param.h>
+#include <linux/audit.h>
 
 #ifdef HAVE_SYS_REG_H
 # include <sys/reg.h>
@@ -99,6 +100,8 @@
 #define TP TRACE_PROCESS
 #define TS TRACE_SIGNAL
 #define NF SYSCALL_NEVER_FAILS
+#define SX SBOX_EXIT
+#define SR SBOX_EXIT_ROOT
 #define MA MAX_ARGS
 
 extern int sbox_not_allowed();
@@ -128,6 +131,8 @@ static const struct sysent sysent2[] = {
 #undef TP
 #undef TS
 #undef NF
+#undef SX
+#undef SR
 #undef MA
 
 /*
@@ -1506,6 +1511,47 @@ get_syscall_args(struct tcb *tcp)
     return 1;
 }
 
+/*
+ * Run the sandbox handler of tcp->scno, shared by the ptrace and the
+ * seccomp user notification engines. Syscalls beyond our table (e.g.,
+ * ones newer than sboxcall.h) are not interposed.
+ */
+int
+sbox_syscall(struct tcb *tcp)
+{
+    if (!SCNO_IN_RANGE(tcp->scno) || !sysent[tcp->scno].sbox_func)
+        return 0;
+    /* the scratch of the hijacked paths first (ptrace engine) */
+    if (entering(tcp) && !(tcp->flags & TCB_NOTIFY) && sbox_inject_enter(tcp))
+        return 0;
+    if (entering(tcp) && tcp->call) {
+        tcp->call->arg = -1;
+        tcp->call->flags = 0;
+    }
+    return (*sysent[tcp->scno].sbox_func)(tcp);
+}
+
+/*
+ * Whether the syscall just entered needs its exit stop: a handler
+ * with exit work (SBOX_EXIT), hijacked args to restore, or the
+ * decoder/counter output. If not, the seccomp engine (-s) resumes
+ * the tracee with PTRACE_CONT, so the syscall is already done here.
+ */
+int
+sbox_needs_exit(struct tcb *tcp)
+{
+    int flags;
+
+    if (tcp->hijacked || tcp->inject || debug_flag || cflag)
+        return 1;
+    if (!SCNO_IN_RANGE(tcp->scno))
+        return 0;
+
+    flags = sysent[tcp->scno].sys_flags;
+    return (flags & SBOX_EXIT)
+        || ((flags & SBOX_EXIT_ROOT) && opt_fakeroot);
+}
+
 static int
 trace_syscall_entering(struct tcb *tcp)
 {
@@ -1603,9 +1649,7 @@ trace_syscall_entering(struct tcb *tcp)
     }
     
     /* sbox */
-    if (sysent[tcp->scno].sbox_func) {
-        sysent[tcp->scno].sbox_func(tcp);
-    }
+    sbox_syscall(tcp);
     
  ret:
     tcp->flags |= TCB_INSYSCALL;
@@ -2057,9 +2101,7 @@ trace_syscall_exiting(struct tcb *tcp)
     }
 
     /* sbox */
-    if (sysent[tcp->scno].sbox_func) {
-        sysent[tcp->scno].sbox_func(tcp);
-    }
+    sbox_syscall(tcp);
 
     if (!debug_flag) {
         goto ret;
@@ -2201,17 +2243,179 @@ trace_syscall_exiting(struct tcb *tcp)
     return 0;
 }
 
+#if defined(X86_64)
+/*
+ * Fetch the registers of a syscall stop into tcp->regs for the lean
+ * dispatch below. Where the kernel has PTRACE_GET_SYSCALL_INFO, only
+ * the syscall registers are filled in (TCB_REGS_PARTIAL); the rest is
+ * fetched by sbox_rewrite_arg() if a handler has to write them back.
+ *
+ * Returns -1 on ptrace error, 0 if not at a syscall entry while
+ * entering, -2 for 32-bit and x32 tracees, 1 otherwise.
+ */
+static int
+get_sbox_regs(struct tcb *tcp)
+{
+    struct user_regs_struct *regs = &tcp->regs;
+
+#ifdef PTRACE_GET_SYSCALL_INFO
+    static bool no_syscall_info = 0;
+    struct __ptrace_syscall_info info;
+
+    while (!no_syscall_info) {
+        if (ptrace(PTRACE_GET_SYSCALL_INFO, tcp->pid,
+                   sizeof(info), (long) &info) <= 0) {
+            /* not supported by this kernel */
+            if (errno == EIO || errno == EINVAL) {
+                no_syscall_info = 1;
+                break;
+            }
+            return -1;
+        }
+
+        if (entering(tcp)) {
+            if (info.op != PTRACE_SYSCALL_INFO_ENTRY
+                && info.op != PTRACE_SYSCALL_INFO_SECCOMP)
+                return 0;
+            if (info.arch != AUDIT_ARCH_X86_64
+                || (info.entry.nr & __X32_SYSCALL_BIT))
+                return -2;
+            regs->orig_rax = info.entry.nr;
+            regs->rax = -ENOSYS;
+            regs->rdi = info.entry.args[0];
+            regs->rsi = info.entry.args[1];
+            regs->rdx = info.entry.args[2];
+            regs->r10 = info.entry.args[3];
+            regs->r8  = info.entry.args[4];
+            regs->r9  = info.entry.args[5];
+        } else {
+            /* e.g., a signal stop in between: take the full regs */
+            if (info.op != PTRACE_SYSCALL_INFO_EXIT)
+                break;
+            regs->rax = info.exit.rval;
+        }
+        regs->rip = info.instruction_pointer;
+        regs->rsp = info.stack_pointer;
+        tcp->flags |= TCB_REGS_PARTIAL;
+        return 1;
+    }
+#endif
+
+    if (ptrace(PTRACE_GETREGS, tcp->pid, NULL, (long) regs) < 0)
+        return -1;
+    if (entering(tcp)) {
+        if (regs->cs != 0x33 || regs->ds == 0x2b)
+            return -2;
+        /* see syscall_fixup_on_sysenter() */
+        if ((long) regs->rax != -ENOSYS)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Lean dispatch, used when nothing is printed or counted (no -d/-c/-T):
+ * a single register fetch per stop and the sandbox handler, none of the
+ * decoders in desc.c, file.c, net.c and others. Returns -2 if the stop
+ * has to take the full path (32-bit and x32 tracees).
+ */
+static int
+sbox_syscall_entering(struct tcb *tcp)
+{
+    int res = get_sbox_regs(tcp);
+
+    if (res < 0 && res != -2)
+        tcp->flags |= TCB_INSYSCALL;
+    if (res != 1)
+        return res;
+
+#if SUPPORTED_PERSONALITIES > 1
+    update_personality(tcp, 0);
+#endif
+    tcp->scno = tcp->regs.orig_rax;
+    tcp->u_nargs = SCNO_IN_RANGE(tcp->scno)
+        ? sysent[tcp->scno].nargs : MAX_ARGS;
+    tcp->u_arg[0] = tcp->regs.rdi;
+    tcp->u_arg[1] = tcp->regs.rsi;
+    tcp->u_arg[2] = tcp->regs.rdx;
+    tcp->u_arg[3] = tcp->regs.r10;
+    tcp->u_arg[4] = tcp->regs.r8;
+    tcp->u_arg[5] = tcp->regs.r9;
+
+    internal_syscall(tcp);
+    tcp->flags &= ~TCB_FILTERED;
+
+    sbox_syscall(tcp);
+
+    tcp->flags |= TCB_INSYSCALL;
+    return 1;
+}
+
+static int
+sbox_syscall_exiting(struct tcb *tcp)
+{
+    int res = -1;
+
+    if (get_sbox_regs(tcp) != 1)
+        goto ret;
+
+    /* see get_error() */
+    tcp->u_error = 0;
+    tcp->u_rval = tcp->regs.rax;
+    if (!(SCNO_IN_RANGE(tcp->scno)
+          && (sysent[tcp->scno].sys_flags & SYSCALL_NEVER_FAILS))
+        && is_negated_errno(tcp->regs.rax)) {
+        tcp->u_rval = -1;
+        tcp->u_error = -tcp->regs.rax;
+    }
+
+    internal_syscall(tcp);
+
+    sbox_syscall(tcp);
+    res = 0;
+
+ ret:
+    tcp->flags &= ~TCB_INSYSCALL;
+    return res;
+}
+#endif
+
 int
 trace_syscall(struct tcb *tcp)
 {
     int ret;
+#if defined(X86_64)
+    const int lean = !debug_flag && !cflag && !Tflag;
+#endif
+
+    /* stops of the mmap() injected for the scratch mapping */
+    if (tcp->inject && sbox_inject_stop(tcp)) {
+        sbox_flush_regs(tcp);
+        return 0;
+    }
+
     if (exiting(tcp)) {
-        ret = trace_syscall_exiting(tcp);
+#if defined(X86_64)
+        if (lean)
+            ret = sbox_syscall_exiting(tcp);
+        else
+#endif
+            ret = trace_syscall_exiting(tcp);
         if (tcp->hijacked) {
             sbox_restore_hijack(tcp);
         }
     } else {
-        ret = trace_syscall_entering(tcp);
+        ret = -2;
+#if defined(X86_64)
+        if (lean)
+            ret = sbox_syscall_entering(tcp);
+#endif
+        if (ret == -2)
+            ret = trace_syscall_entering(tcp);
     }
+
+    /* write back the paths and registers rewritten by the handlers */
+    sbox_flush_stage(tcp);
+    sbox_flush_regs(tcp);
     return ret;
 }
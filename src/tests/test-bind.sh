@@ -0,0 +1,23 @@
+#!/bin/bash -x
+#
+# pre: which python3
+# pre: test -d tests
+# pre: test ! -e tests/sock
+# post: test -S $SPWD/tests/sock
+# post: test ! -e $HPWD/tests/sock
+# post: grep -q "/tests/sock$" $SPWD/out-bind
+#
+
+# tests/ is synced into the sboxfs, as a parent dir
+echo 1 > tests/x
+cd tests
+
+# the cwd stays in the hostfs under -u (see. notify.c)
+case $(readlink /proc/self/cwd) in
+    $SPWD/*) ;;
+    *) exit 1;;
+esac
+
+# bind() isn't interposed, but the socket is found by its host path
+python3 -c 'import socket; socket.socket(socket.AF_UNIX).bind("sock")'
+ls $HPWD/tests/sock > ../out-bind
@@ -0,0 +1,13 @@
+#!/bin/bash -x
+#
+# pre: test ! -e s.sh
+# post: test -x $SPWD/s.sh
+# post: grep -q "^ok$" $SPWD/out-s
+#
+
+# execve() checks the mode of the sandbox copy (not under -u, where
+# execve() always runs the host binary)
+echo "echo ok" > s.sh
+chmod 644 s.sh
+chmod +x s.sh
+./s.sh > out-s
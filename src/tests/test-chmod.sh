@@ -0,0 +1,13 @@
+#!/bin/bash -x
+#
+# pre: test -f tests/NOTE
+# post: test $(stat -c %a $SPWD/tests/NOTE) = 600
+# post: test $(stat -c %a $HPWD/tests/NOTE) != 600
+# post: cmp -s $SPWD/tests/NOTE $HPWD/tests/NOTE
+# post: grep -q "^600 978307200$" $SPWD/stat-note
+#
+
+# copied up, the changes go to the copy
+chmod 600 ./tests/NOTE
+touch -c -m -d @978307200 ./tests/NOTE
+stat -c "%a %Y" ./tests/NOTE > stat-note
@@ -0,0 +1,18 @@
+#!/bin/bash -x
+#
+# pre: test ! -d cwd-a
+# post: test -f $SPWD/cwd-b/file
+# post: test -f $SPWD/cwd-b/moved
+# post: test -f $SPWD/cwd-b/sub/file
+#
+
+mkdir cwd-a cwd-a/sub
+cd cwd-a
+echo 1 > file
+cd sub
+echo 1 > file
+cd ..
+cat sub/file
+mv ../cwd-a ../cwd-b
+echo 1 > moved
+cat file
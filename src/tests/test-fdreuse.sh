@@ -0,0 +1,34 @@
+#!/bin/bash -x
+#
+# pre: which python3
+# pre: test -d tests
+# pre: test -d linux
+# pre: test ! -e linux/x
+# post: grep -q "^close ENOENT$" $SPWD/out-fdreuse
+# post: grep -q "^close_range ENOENT$" $SPWD/out-fdreuse
+#
+
+# x is in the sandboxfs, in tests/ only
+echo 1 > tests/x
+
+# an fd of tests/ is closed and reused for linux/: linux/x is looked
+# up, not tests/x as the fd was before
+python3 -c '
+import os, ctypes
+libc = ctypes.CDLL(None, use_errno=True)
+for how in ["close", "close_range"]:
+    d = os.open("tests", os.O_RDONLY | os.O_DIRECTORY)
+    os.stat("x", dir_fd=d)
+    if how == "close":
+        os.close(d)
+    else:
+        libc.syscall(436, d, d, 0)
+    e = os.open("linux", os.O_RDONLY | os.O_DIRECTORY)
+    assert d == e
+    try:
+        os.stat("x", dir_fd=e)
+        print(how, "found")
+    except FileNotFoundError:
+        print(how, "ENOENT")
+    os.close(e)
+' > out-fdreuse
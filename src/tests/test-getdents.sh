@@ -0,0 +1,19 @@
+#!/bin/bash -x
+#
+# pre: test -f tests/NOTE
+# pre: test -f tests/test-vim.sh
+# post: grep -qx NOTE $SPWD/ls-tests
+# post: grep -qx new-file $SPWD/ls-tests
+# post: ! grep -qx test-vim.sh $SPWD/ls-tests
+# post: test $(grep -cx test-fork.sh $SPWD/ls-tests) = 1
+# post: test $(grep -cx "\.\." $SPWD/ls-tests) = 1
+# post: test $(ls $HPWD/tests | wc -l) = $(grep -vcx "\.\.\?" $SPWD/ls-tests)
+#
+
+# in the sandbox only, copied up, and deleted
+touch ./tests/new-file
+echo >> ./tests/test-fork.sh
+rm ./tests/test-vim.sh
+
+# each listed once
+ls -a ./tests > ls-tests
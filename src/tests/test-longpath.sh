@@ -0,0 +1,25 @@
+#!/bin/bash -x
+#
+# post: test "$(cat $SPWD/out-longpath)" = "$(printf 'ok\nENAMETOOLONG')"
+#
+
+# a dir about as deep as a path gets, where a relative name fits the
+# kernel's limit, but along the dir only once normalized (../), or not
+python3 - > out-longpath <<'EOF2'
+import errno, os
+
+def create(name):
+    try:
+        open(name, "w").close()
+        print("ok" if os.path.exists(os.path.basename(name)) else "elsewhere")
+    except OSError as e:
+        print(errno.errorcode[e.errno])
+
+os.makedirs("tests/long")
+os.chdir("tests/long")
+while len(os.getcwd()) < os.pathconf("/", "PC_PATH_MAX") - 250:
+    os.mkdir("d" * 100)
+    os.chdir("d" * 100)
+create(("../" + "d" * 100 + "/") * 3 + "f")
+create("g" * 255)
+EOF2
@@ -0,0 +1,28 @@
+#!/bin/bash -x
+#
+# pre: which python3
+# pre: test -f tests/NOTE
+# pre: test -d linux
+# pre: test ! -e x
+# post: cmp -s $HPWD/tests/NOTE $SPWD/x
+# post: grep -q "^exchanged$" $SPWD/tests/NOTE
+# post: grep -q "^# NOTE" $HPWD/tests/NOTE
+# post: grep -q "^22$" $SPWD/out-dir
+# post: test ! -e $SPWD/linux
+#
+
+renameat2() {
+    python3 -c '
+import ctypes, sys
+libc = ctypes.CDLL(None, use_errno=True)
+ret = libc.renameat2(-100, sys.argv[1].encode(), -100, sys.argv[2].encode(), 2)
+print(ctypes.get_errno() if ret else 0)' "$@"
+}
+
+# RENAME_EXCHANGE copies the host file up, instead of moving it
+echo exchanged > x
+renameat2 ./tests/NOTE x
+
+# a dir only in the hostfs can't be exchanged (EINVAL)
+mkdir y
+renameat2 ./linux y > out-dir
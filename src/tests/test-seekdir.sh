@@ -0,0 +1,54 @@
+#!/bin/bash -x
+#
+# pre: test -f tests/NOTE
+# post: test -f $SPWD/out-seekdir
+# post: grep -qx NOTE $SPWD/out-seekdir
+# post: grep -qx new-file $SPWD/out-seekdir
+#
+
+# in the sandbox only, so tests/ lists both
+touch ./tests/new-file
+
+# seekdir() to each telldir() gives the entry that followed it, also
+# among the hostfs ones of the listing
+python3 - ./tests > out-seekdir <<'EOF' || rm -f out-seekdir
+import ctypes, sys
+
+class dirent(ctypes.Structure):
+    _fields_ = [("d_ino", ctypes.c_uint64), ("d_off", ctypes.c_int64),
+                ("d_reclen", ctypes.c_ushort), ("d_type", ctypes.c_ubyte),
+                ("d_name", ctypes.c_char * 256)]
+
+libc = ctypes.CDLL(None, use_errno=True)
+libc.opendir.restype = ctypes.c_void_p
+libc.readdir.argtypes = [ctypes.c_void_p]
+libc.readdir.restype = ctypes.POINTER(dirent)
+libc.telldir.argtypes = [ctypes.c_void_p]
+libc.telldir.restype = ctypes.c_long
+libc.seekdir.argtypes = [ctypes.c_void_p, ctypes.c_long]
+
+def next_name(d):
+    e = libc.readdir(d)
+    return e.contents.d_name.decode() if e else None
+
+d = libc.opendir(sys.argv[1].encode())
+pos, names = [], []
+while True:
+    pos.append(libc.telldir(d))
+    name = next_name(d)
+    if name is None:
+        break
+    names.append(name)
+
+if len(set(names)) != len(names):
+    sys.exit("listed twice")
+for i in reversed(range(len(names))):
+    libc.seekdir(d, pos[i])
+    if next_name(d) != names[i]:
+        sys.exit("seekdir to #%d: not %s" % (i, names[i]))
+libc.seekdir(d, pos[len(names)])
+if next_name(d) is not None:
+    sys.exit("seekdir to the end")
+
+print("\n".join(names))
+EOF
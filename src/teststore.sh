@@ -0,0 +1,56 @@
+#!/bin/bash
+#
+# copy up through a store shared by two sandboxes (-K), e.g.,
+# ./teststore.sh -s. without FICLONE (e.g., ext4, tmpfs), the store
+# is turned off at the first miss and files are copied up as usual.
+#
+
+H=$(mktemp -d /tmp/mbox-store-XXXXX)
+K=$(mktemp -d /tmp/mbox-store-k-XXXXX)
+R1=$(mktemp -d /tmp/mbox-store-r1-XXXXX)
+R2=$(mktemp -d /tmp/mbox-store-r2-XXXXX)
+OUT=$(mktemp /tmp/teststore-out-XXXXX)
+
+fail() {
+  echo "ERR: $*"
+  echo ">> stdout:"
+  cat $OUT
+  exit 1
+}
+
+echo old > $H/f
+head -c 100000 /dev/urandom > $H/big
+
+append() {
+  ./mbox -i -n "$@" -K $K -- bash -c "echo new >> $H/f; echo new >> $H/big" \
+    </dev/null >$OUT 2>&1
+}
+
+printf "Testing %-35s ... " "copy-up through the store"
+append -r $R1 "$@"
+grep -q "^new$" $R1$H/f || fail "f not copied up"
+cmp -s <(cat $H/big; echo new) $R1$H/big || fail "big not copied up"
+grep -q "$H/f ($(sha256sum < $H/f | cut -d' ' -f1))" $OUT || fail "digest of f"
+grep -q "$H/big ($(sha256sum < $H/big | cut -d' ' -f1))" $OUT || fail "digest of big"
+test -z "$(find $K -name '.tmp.*')" || fail "left temporary files"
+if grep -q "not used" $OUT; then
+  SHARED=0
+  echo "OK (no FICLONE, store off)"
+else
+  SHARED=1
+  test $(find $K -type f | wc -l) = 2 || fail "not in the store"
+  echo "OK"
+fi
+
+printf "Testing %-35s ... " "shared with another sandbox"
+append -r $R2 "$@"
+grep -q "^new$" $R2$H/f || fail "f not copied up"
+cmp -s $R1$H/big $R2$H/big || fail "big not copied up"
+if [ $SHARED = 1 ]; then
+  grep -q "(2 from the store)" $OUT || fail "not shared"
+  echo "OK"
+else
+  echo "OK (no FICLONE, store off)"
+fi
+
+rm -rf $H $K $R1 $R2 $R1.meta $R1.journal $R2.meta $R2.journal $OUT
@@ -39,7 +39,10 @@
 #include <fcntl.h>
 #include <termios.h>
 #include <unistd.h>
-#include <openssl/md5.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include "digest.h"
 
 #if HAVE_SYS_UIO_H
 # include <sys/uio.h>
@@ -864,6 +867,26 @@ umovestr(struct tcb *tcp, long addr, int len, char *laddr)
         char x[sizeof(long)];
     } u;
 
+    /* a string arg, read (at most PATH_MAX) only the first time */
+    if (tcp->strs) {
+        struct tcb_strs *strs = tcp->strs;
+
+        for (i = 0; i < MAX_ARGS && tcp->u_arg[i] != addr; i++)
+            ;
+        if (i < MAX_ARGS && addr != 0) {
+            if (strs->ret[i] == -2) {
+                tcp->strs = NULL;
+                strs->ret[i] = umovestr(tcp, addr, PATH_MAX, strs->buf[i]);
+                tcp->strs = strs;
+            }
+            if (strs->ret[i] < 0)
+                return strs->ret[i];
+            n = strs->ret[i] ? strlen(strs->buf[i]) + 1 : PATH_MAX;
+            memcpy(laddr, strs->buf[i], MIN(n, len));
+            return strs->ret[i] && n <= len;
+        }
+    }
+
 #if SUPPORTED_PERSONALITIES > 1
     if (current_wordsize < sizeof(addr))
         addr &= (1ul << 8 * current_wordsize) - 1;
@@ -1585,8 +1608,96 @@ touch(char *dst, int mode)
     return 1;
 }
 
+#define COPY_CHUNK (8 << 20)        /* per copy_file_range()/sendfile() */
+#define COPY_BUF   (128 << 10)      /* per read()/write(), or to hash */
+#define COPY_HASH_ASYNC (1 << 20)   /* hashed by a thread, from this size */
+
+/* copy [off, off+len) in the kernel, 0 if it can't be done there */
+static int
+copy_in_kernel(int src_fd, int dst_fd, off_t off, off_t len)
+{
+    static int no_copy_range = 0;
+    ssize_t n;
+
+#ifdef __NR_copy_file_range
+    while (!no_copy_range && len > 0) {
+        loff_t in = off;
+        loff_t out = off;
+        n = syscall(__NR_copy_file_range, src_fd, &in, dst_fd, &out,
+                    (size_t)MIN(len, COPY_CHUNK), 0);
+        if (n <= 0) {
+            // e.g., not the same fs (old kernels), or not supported
+            if (n < 0 && errno != EXDEV && errno != ENOSYS
+                && errno != EINVAL && errno != EOPNOTSUPP) {
+                return -1;
+            }
+            if (n < 0 && errno == ENOSYS) {
+                no_copy_range = 1;
+            }
+            break;
+        }
+        off += n;
+        len -= n;
+    }
+#endif
+
+    if (len > 0 && lseek(dst_fd, off, SEEK_SET) == off) {
+        while (len > 0) {
+            off_t in = off;
+            n = sendfile(dst_fd, src_fd, &in, MIN(len, COPY_CHUNK));
+            if (n <= 0) {
+                break;
+            }
+            off += n;
+            len -= n;
+        }
+    }
+    return len == 0;
+}
+
+/* copy [off, off+len) through a buffer (or only read it if dst_fd < 0),
+   hashing it if ctx */
+static int
+copy_in_user(int src_fd, int dst_fd, off_t off, off_t len,
+             char *buf, EVP_MD_CTX *ctx)
+{
+    while (len > 0) {
+        ssize_t n = pread(src_fd, buf, MIN(len, COPY_BUF), off);
+        if (n <= 0) {
+            return n == 0;
+        }
+        if (dst_fd >= 0 && pwrite(dst_fd, buf, n, off) != n) {
+            perror("write:");
+            return 0;
+        }
+        if (ctx) {
+            digest_update(ctx, buf, n);
+        }
+        off += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static char *
+copy_buf(void)
+{
+    char *buf = malloc(COPY_BUF);
+    if (!buf) {
+        die_out_of_memory();
+    }
+    return buf;
+}
+
+//
+// copy src to dst, as cheap as it gets on the filesystems: share the
+// blocks (FICLONE), or copy them in the kernel, or through a buffer.
+// holes are kept, so a sparse file stays sparse. digest gets the alg
+// digest of src, if alg: a small file is hashed along the copy through
+// the buffer, a large one by a thread while the copy runs in the kernel.
+//
 int
-copyfile(char *src, char *dst, byte *md5)
+copyfile(char *src, char *dst, const struct digest *alg, byte *digest)
 {
     struct stat src_stat;
     if (stat(src, &src_stat) < 0) {
@@ -1620,33 +1731,195 @@ copyfile(char *src, char *dst, byte *md5)
         return 0;
     }
 
-    MD5_CTX ctx;
-    if (md5) {
-        MD5_Init(&ctx);
-    }
-    
-    char buf[PAGE_SIZE];
-    
-    int bytes;
+    char *buf = NULL;
+    const off_t size = src_stat.st_size;
+    off_t off = 0;
+    int cloned = 0;
     int ret = 1;
-    while ((bytes = read(src_fd, buf, sizeof(buf))) > 0) {
-        if (write(dst_fd, buf, bytes) != bytes) {
-            perror("write:");
-            ret = 0;
-            break;
+
+    // hashed in the copy loop (ctx), or aside (job)
+    EVP_MD_CTX *ctx = NULL;
+    struct digest_job job;
+    int async = 0;
+    if (alg && size >= COPY_HASH_ASYNC) {
+        async = digest_fd_start(&job, alg, src_fd, size, digest);
+    }
+    if (alg && !async) {
+        ctx = digest_begin(alg);
+    }
+
+#ifdef FICLONE
+    // same CoW filesystem: nothing to copy
+    cloned = ioctl(dst_fd, FICLONE, src_fd) == 0;
+#endif
+
+    while (ret && off < size) {
+        // next extent of data, [data, hole)
+        off_t data = lseek(src_fd, off, SEEK_DATA);
+        off_t hole;
+        if (data < 0) {
+            // a hole up to the end, or no SEEK_DATA (all data)
+            data = errno == ENXIO ? size : off;
+            hole = size;
+        } else {
+            hole = lseek(src_fd, data, SEEK_HOLE);
+            if (hole < 0 || hole > size) {
+                hole = size;
+            }
+        }
+
+        // a hole reads as zeros
+        if (ctx && data > off) {
+            if (!buf) {
+                buf = copy_buf();
+            }
+            memset(buf, 0, COPY_BUF);
+            for (; off < data; off += MIN(data - off, COPY_BUF)) {
+                digest_update(ctx, buf, MIN(data - off, COPY_BUF));
+            }
+        }
+        off = data;
+
+        if (cloned && !ctx) {
+            off = hole;
+            continue;
+        }
+
+        int copied = 0;
+        if (!cloned && !ctx) {
+            copied = copy_in_kernel(src_fd, dst_fd, off, hole - off);
+            if (copied < 0) {
+                perror("copy_file_range:");
+                ret = 0;
+                break;
+            }
         }
-        if (md5) {
-            MD5_Update(&ctx, buf, bytes);
+        if (!copied) {
+            if (!buf) {
+                buf = copy_buf();
+            }
+            // if cloned, only to hash
+            ret = copy_in_user(src_fd, cloned ? -1 : dst_fd, off, hole - off,
+                               buf, ctx);
         }
+        off = hole;
+    }
+
+    // a trailing hole
+    if (ret && !cloned && ftruncate(dst_fd, size) < 0) {
+        perror("ftruncate:");
+        ret = 0;
+    }
+
+    // before closing src_fd, the thread reads it
+    if (async && !digest_fd_wait(&job)) {
+        ret = 0;
+    }
+    if (ctx) {
+        digest_end(ctx, digest);
     }
 
+    free(buf);
     close(src_fd);
     close(dst_fd);
 
-    if (md5) {
-        MD5_Final(md5, &ctx);
+    return ret;
+}
+
+//
+// a new dst sharing the blocks of src (FICLONE), with mode: 0 (errno
+// set) if src can't be opened, or the filesystem can't share them,
+// and then no dst is left behind.
+//
+int
+clonefile(char *src, char *dst, mode_t mode)
+{
+    int src_fd = open(src, O_RDONLY);
+    if (src_fd < 0) {
+        return 0;
+    }
+
+    int dst_fd = open(dst, O_CREAT|O_EXCL|O_WRONLY, mode);
+    if (dst_fd < 0) {
+        close(src_fd);
+        return 0;
+    }
+
+    int ret = 0;
+#ifdef FICLONE
+    ret = ioctl(dst_fd, FICLONE, src_fd) == 0;
+#else
+    errno = EOPNOTSUPP;
+#endif
+    int saved = errno;
+
+    close(src_fd);
+    close(dst_fd);
+    if (!ret) {
+        unlink(dst);
+        errno = saved;
     }
-    
+    return ret;
+}
+
+//
+// as clonefile(), but dst shows up whole or not at all: src is cloned
+// into an unnamed file (O_TMPFILE, or a mkstemp() one if the
+// filesystem can't) in the dir of dst, then linked as dst. 0 (errno
+// set) on failure, EEXIST if dst is already there.
+//
+int
+clonefile_link(char *src, char *dst, mode_t mode)
+{
+    char tmp[PATH_MAX];
+    char *slash = strrchr(dst, '/');
+    int src_fd, fd, ret = 0, saved;
+
+    if (!slash || slash - dst + sizeof("/.tmp.XXXXXX") > sizeof(tmp)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    memcpy(tmp, dst, slash - dst);
+    tmp[slash - dst] = '\0';
+
+    src_fd = open(src, O_RDONLY);
+    if (src_fd < 0) {
+        return 0;
+    }
+    fd = open(tmp, O_TMPFILE|O_WRONLY, mode);
+    if (fd >= 0) {
+        tmp[0] = '\0';
+    } else {
+        strcat(tmp, "/.tmp.XXXXXX");
+        fd = mkstemp(tmp);
+        if (fd < 0) {
+            close(src_fd);
+            return 0;
+        }
+        fchmod(fd, mode);
+    }
+
+#ifdef FICLONE
+    ret = ioctl(fd, FICLONE, src_fd) == 0;
+#else
+    errno = EOPNOTSUPP;
+#endif
+    if (ret && tmp[0]) {
+        ret = link(tmp, dst) == 0;
+    } else if (ret) {
+        // linkat(AT_EMPTY_PATH) needs CAP_DAC_READ_SEARCH, this doesn't
+        snprintf(tmp, sizeof(tmp), "/proc/self/fd/%d", fd);
+        ret = linkat(AT_FDCWD, tmp, AT_FDCWD, dst, AT_SYMLINK_FOLLOW) == 0;
+        tmp[0] = '\0';
+    }
+    saved = errno;
+
+    close(src_fd);
+    close(fd);
+    if (tmp[0]) {
+        unlink(tmp);
+    }
+    errno = saved;
     return ret;
 }
 
@@ -1704,6 +1977,7 @@ kbhit(void)
 
 // name is \0 ended and abspath.
 // name won't be overwritten longer than the given length.
+// return the length of the normalized name.
 int
 normalize_path(char *name)
 {
@@ -1774,7 +2048,7 @@ normalize_path(char *name)
     }
 
     *head = '\0';
-    return 0;
+    return head - name;
 }
 
 int strbeg(const char *str, const char *prefix) {